@@ -0,0 +1,12 @@
+//
+// 簡単なライティングの計算
+//   shared_uniforms.glslの後にインクルードする
+//
+
+// 拡散光の強さ
+//   position 視点座標系での位置
+//   normal   視点座標系での法線
+float calcDiffuse(vec4 position, vec3 normal) {
+  vec3 light = normalize((LightPosition * position.w - position * LightPosition.w).xyz);
+  return max(dot(light, normal), 0.0);
+}
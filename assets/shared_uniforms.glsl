@@ -0,0 +1,17 @@
+//
+// 全てのシェーダーで共有するuniform(SharedUniforms.hpp)
+//
+
+layout(std140) uniform Camera {
+  mat4 ViewMatrix;
+  mat4 ProjectionMatrix;
+  mat4 ViewProjectionMatrix;
+};
+
+layout(std140) uniform Light {
+  vec4 LightPosition;
+  vec4 LightAmbient;
+  vec4 LightDiffuse;
+};
+
+uniform mat4 ciModelMatrix;
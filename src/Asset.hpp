@@ -3,15 +3,125 @@
 //
 // アセット読み込み
 //  OSX版のみDEBUGビルドで特殊なパスから読み込むようにしている
+//  assets.packがあれば、そこに入っているものはパックから読み込む
 //
 
+#include <cinder/ImageIo.h>
+#include <cinder/Surface.h>
+#include <cinder/Timer.h>
+#include <map>
+#include <mutex>
+#include "AssetPack.hpp"
 #include "Path.hpp"
+#include "Timing.hpp"
 
 
 namespace ngs { namespace Asset {
 
+// 読み込みの統計
+struct Stats {
+  int pack_num     = 0;
+  int file_num     = 0;
+  double pack_time = 0.0;
+  double file_time = 0.0;
+};
+
+// TIPS:別スレッドからも読み込むので、排他して読み書きする
+std::mutex& getStatsMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+Stats& getStats() {
+  static Stats stats;
+  return stats;
+}
+
+
+// パックに入っていればそこから、無ければ個別のファイルから読み込む
+//   TIPS:個別のファイルは開発中の差し替え用
 ci::DataSourceRef load(const std::string& path) noexcept {
-  return ci::loadFile(getAssetPath(path));
+  ci::Timer timer(true);
+
+  auto source = getAssetPack().load(path);
+  bool from_pack = bool(source);
+  if (!from_pack) {
+    source = ci::loadFile(getAssetPath(path));
+  }
+
+  std::lock_guard<std::mutex> lock(getStatsMutex());
+  auto& stats = getStats();
+  if (from_pack) {
+    stats.pack_num  += 1;
+    stats.pack_time += timer.getSeconds();
+  }
+  else {
+    stats.file_num  += 1;
+    stats.file_time += timer.getSeconds();
+  }
+
+  return source;
+}
+
+// 読み込みの統計を出力
+void reportStats() {
+  std::lock_guard<std::mutex> lock(getStatsMutex());
+  const auto& stats = getStats();
+
+  DOUT << "asset:"
+       << " pack " << stats.pack_num << " (" << stats.pack_time * 1000.0 << " ms)"
+       << " file " << stats.file_num << " (" << stats.file_time * 1000.0 << " ms)"
+       << std::endl;
+}
+
+
+// 先読みしたデータ
+//   別スレッドで読み込んだ結果を置いておき、使う側が一度だけ受け取る
+template <typename T>
+class Cache {
+  std::mutex mutex_;
+  std::map<std::string, T> data_;
+
+
+public:
+  void store(const std::string& path, T data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_.erase(path);
+    data_.insert(std::make_pair(path, std::move(data)));
+  }
+
+  bool take(const std::string& path, T& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = data_.find(path);
+    if (it == std::end(data_)) return false;
+
+    data = std::move(it->second);
+    data_.erase(it);
+    return true;
+  }
+
+};
+
+
+Cache<ci::Surface8u>& getImageCache() {
+  static Cache<ci::Surface8u> cache;
+  return cache;
+}
+
+// 画像を展開して先読みしておく(別スレッドから呼ぶ)
+void preloadImage(const std::string& path) {
+  ScopedTiming timing("decode " + path);
+  getImageCache().store(path, ci::Surface8u(ci::loadImage(load(path))));
+}
+
+// 画像の読み込み
+//   先読みしてあればそれを使う
+ci::Surface8u loadImage(const std::string& path) {
+  ci::Surface8u surface;
+  if (getImageCache().take(path, surface)) return surface;
+
+  ScopedTiming timing("decode " + path);
+  return ci::Surface8u(ci::loadImage(load(path)));
 }
 
 } }
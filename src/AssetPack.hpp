@@ -0,0 +1,276 @@
+﻿#pragma once
+
+//
+// アセットをまとめた一つのファイル
+//   起動時にマップしておき、個別のファイルを開かずに読み込む
+//
+//   ファイルの構成
+//     Header
+//     Entry * entry_num(名前のハッシュ値順)
+//     名前(names_size)
+//     データ(ALIGNMENT境界に揃える)
+//
+//   TIPS:LZ4で小さくなるものだけ圧縮して格納する(size != original_sizeなら圧縮済み)
+//
+
+#include <cinder/DataSource.h>
+#include <cinder/Filesystem.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "LZ4.hpp"
+#include "MappedFile.hpp"
+#include "Path.hpp"
+
+
+namespace ngs {
+
+class AssetPack {
+public:
+  enum {
+    VERSION   = 1,
+    ALIGNMENT = 16,
+  };
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_num;
+    uint32_t names_size;
+  };
+
+  struct Entry {
+    uint64_t hash;
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t original_size;
+  };
+
+
+private:
+  MappedFile file_;
+
+  const Entry* entries_ = nullptr;
+  uint32_t entry_num_   = 0;
+  const char* names_    = nullptr;
+
+
+  // FNV-1a
+  static uint64_t hash(const std::string& name) {
+    uint64_t h = 14695981039346656037ull;
+    for (auto c : name) {
+      h ^= uint8_t(c);
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  const Entry* find(const std::string& name) const {
+    uint64_t h = hash(name);
+    auto it = std::lower_bound(entries_, entries_ + entry_num_, h,
+                               [](const Entry& entry, const uint64_t h) {
+                                 return entry.hash < h;
+                               });
+
+    // TIPS:ハッシュ値が衝突していても名前で区別できる
+    for (; (it != entries_ + entry_num_) && (it->hash == h); ++it) {
+      if ((it->name_size == name.size()) && (name.compare(0, name.size(), names_ + it->name_offset, it->name_size) == 0)) {
+        return it;
+      }
+    }
+    return nullptr;
+  }
+
+
+public:
+  explicit AssetPack(const ci::fs::path& path)
+    : file_(path)
+  {
+    if (!file_.isOpen() || (file_.getSize() < sizeof(Header))) return;
+
+    Header header;
+    std::memcpy(&header, file_.getData(), sizeof(header));
+    if ((std::memcmp(header.magic, "NGSP", 4) != 0) || (header.version != VERSION)) {
+      DOUT << "asset pack: unsupported version " << path << std::endl;
+      return;
+    }
+
+    size_t index_size = sizeof(Header) + sizeof(Entry) * header.entry_num + header.names_size;
+    if (file_.getSize() < index_size) return;
+
+    // TIPS:マップした先頭はページ境界なので、Entryの配列はそのまま参照できる
+    entries_   = reinterpret_cast<const Entry*>(file_.getData() + sizeof(Header));
+    entry_num_ = header.entry_num;
+    names_     = reinterpret_cast<const char*>(entries_ + entry_num_);
+  }
+
+
+  bool isOpen() const {
+    return entries_ != nullptr;
+  }
+
+  size_t getEntryNum() const {
+    return entry_num_;
+  }
+
+
+  // 圧縮していないデータの場所
+  //   TIPS:マップした領域を直接指す
+  bool findRaw(const std::string& name, const uint8_t*& data, size_t& size) const {
+    if (!isOpen()) return false;
+
+    const auto* entry = find(name);
+    if (!entry || (entry->size != entry->original_size)) return false;
+    if ((entry->offset + entry->size) > file_.getSize()) return false;
+
+    data = file_.getData() + entry->offset;
+    size = entry->size;
+    return true;
+  }
+
+  // 読み込む(無ければnullptr)
+  //   圧縮していなければマップした領域をそのまま使う
+  ci::DataSourceRef load(const std::string& name) const {
+    if (!isOpen()) return nullptr;
+
+    const auto* entry = find(name);
+    if (!entry || ((entry->offset + entry->size) > file_.getSize())) return nullptr;
+
+    const uint8_t* data = file_.getData() + entry->offset;
+    ci::BufferRef buffer;
+    if (entry->size == entry->original_size) {
+      // TIPS:メモリを所有しないBufferになる
+      buffer = ci::Buffer::create(const_cast<uint8_t*>(data), entry->size);
+    }
+    else {
+      buffer = ci::Buffer::create(entry->original_size);
+      if (!LZ4::decompress(data, entry->size, static_cast<uint8_t*>(buffer->getData()), entry->original_size)) {
+        DOUT << "asset pack: broken entry " << name << std::endl;
+        return nullptr;
+      }
+    }
+
+    // TIPS:拡張子で画像や音声の形式を判断するので、名前を渡しておく
+    return ci::DataSourceBuffer::create(buffer, name);
+  }
+
+
+  // ディレクトリ内のファイルをまとめて書き出す
+  //   名前はディレクトリからの相対パス(区切りは'/')
+  static bool build(const ci::fs::path& directory, const ci::fs::path& output) {
+    struct Source {
+      std::string name;
+      std::vector<uint8_t> data;
+      uint32_t original_size;
+    };
+    std::vector<Source> sources;
+
+    for (ci::fs::recursive_directory_iterator it(directory), end; it != end; ++it) {
+      const auto& path = it->path();
+      if (!ci::fs::is_regular_file(path)) continue;
+      if ((path.extension() == ".pack") || (path.extension() == ".tmp")) continue;
+
+      std::ifstream ifs(path.string(), std::ios::binary);
+      std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+      Source source;
+      source.name = path.string().substr(directory.string().size() + 1);
+      std::replace(std::begin(source.name), std::end(source.name), '\\', '/');
+      source.original_size = uint32_t(data.size());
+
+      // 変換済みメッシュはマップしたまま転送するので圧縮しない
+      // TIPS:画像や音声はほとんど縮まないので、圧縮しても展開の手間が増えるだけ
+      auto compressed = LZ4::compress(data.data(), data.size());
+      if ((path.extension() != ".mesh") && (compressed.size() < data.size() * 9 / 10)) {
+        source.data = std::move(compressed);
+      }
+      else {
+        source.data = std::move(data);
+      }
+      sources.push_back(std::move(source));
+    }
+
+    std::sort(std::begin(sources), std::end(sources),
+              [](const Source& a, const Source& b) {
+                return hash(a.name) < hash(b.name);
+              });
+
+    std::string names;
+    for (const auto& source : sources) {
+      names += source.name;
+    }
+
+    Header header;
+    std::memcpy(header.magic, "NGSP", 4);
+    header.version    = VERSION;
+    header.entry_num  = uint32_t(sources.size());
+    header.names_size = uint32_t(names.size());
+
+    auto align = [](const uint64_t offset) {
+      return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    };
+
+    std::vector<Entry> entries;
+    uint32_t name_offset = 0;
+    uint64_t offset = align(sizeof(Header) + sizeof(Entry) * sources.size() + names.size());
+    for (const auto& source : sources) {
+      Entry entry = {
+        hash(source.name),
+        name_offset,
+        uint32_t(source.name.size()),
+        offset,
+        uint32_t(source.data.size()),
+        source.original_size,
+      };
+      entries.push_back(entry);
+
+      name_offset += uint32_t(source.name.size());
+      offset = align(offset + source.data.size());
+    }
+
+    // TIPS:読み込み中のパックを上書きしないよう、別名で書き出してから置き換える
+    auto temp = output;
+    temp += ".tmp";
+    {
+      std::ofstream ofs(temp.string(), std::ios::binary);
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+      ofs.write(names.data(), names.size());
+
+      for (size_t i = 0; i < sources.size(); ++i) {
+        // 揃えるための隙間
+        std::vector<char> padding(entries[i].offset - uint64_t(ofs.tellp()), 0);
+        ofs.write(padding.data(), padding.size());
+
+        const auto& data = sources[i].data;
+        ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+      }
+      if (!ofs) return false;
+    }
+
+    try {
+      ci::fs::rename(temp, output);
+    }
+    catch (const std::exception& e) {
+      DOUT << "asset pack: " << e.what() << std::endl;
+      return false;
+    }
+
+    DOUT << "asset pack: " << sources.size() << " entries" << std::endl;
+    return true;
+  }
+
+};
+
+
+// 起動時に一度だけマップする
+//   TIPS:assetsのパックが無ければ、全て個別のファイルから読み込む
+const AssetPack& getAssetPack() {
+  static AssetPack pack(getAssetPath("assets.pack"));
+  return pack;
+}
+
+}
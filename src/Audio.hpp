@@ -5,10 +5,21 @@
 //
 //  同じ名前のサウンドは直前のを止めて鳴らす方式
 //
+//  効果音は最初に鳴らす時に展開する
+//  priorityが0より大きいものは、優先度の高い順に別スレッドで先に展開しておく
+//  展開したバッファは容量の上限を決めて保持し、超えたら長く使っていないものから捨てる
+//  長いサウンドは展開せず、ファイルから読みながら再生する
+//
 
 #include <cinder/audio/audio.h>
+#include <cinder/Timer.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
 #include <map>
+#include <thread>
 #include "Asset.hpp"
+#include "Timing.hpp"
 
 
 namespace ngs {
@@ -17,15 +28,47 @@ struct AudioInfo {
   std::string type;
   std::string category;
   bool loop;
+
+  std::string file;
+  int priority;
 };
 
 
 class Audio {
+public:
+  struct Stats {
+    // 展開した数と時間(秒)
+    int prefetched_num    = 0;
+    double prefetch_time  = 0.0;
+    int decoded_num       = 0;
+    double decode_time    = 0.0;
+    // 展開せずに再生した数
+    int streamed_num = 0;
+    // 上限を超えて捨てた数
+    int evicted_num = 0;
+    // 保持しているバッファの大きさ
+    size_t resident_bytes = 0;
+  };
+
+
+private:
   std::map<std::string, AudioInfo> infos_;
 
-  
+  size_t sample_rate_;
+  // 展開したバッファを保持する上限
+  size_t budget_bytes_;
+  // これより長いサウンドは展開しない(秒)
+  double stream_seconds_;
+
   // 効果音用
-  std::map<std::string, ci::audio::BufferRef> buffer_;
+  //   TIPS:lru_の先頭が最近使ったもの
+  struct Buffer {
+    ci::audio::BufferRef buffer;
+    size_t bytes;
+    std::list<std::string>::iterator lru;
+  };
+  std::map<std::string, Buffer> buffer_;
+  std::list<std::string> lru_;
   std::map<std::string, ci::audio::BufferPlayerNodeRef> buffer_node_;
 
   // ストリーミング再生用
@@ -35,89 +78,240 @@ class Audio {
   // 停止用
   std::map<std::string, ci::audio::SamplePlayerNodeRef> category_node_;
 
+  // 先読み
+  Asset::Cache<ci::audio::BufferRef> prefetched_;
+  std::thread prefetch_thread_;
+  std::atomic<bool> quit_;
+  // 別スレッドから書き込むので、読むのはスレッドが終わった後か統計の表示だけ
+  std::atomic<int> prefetched_num_;
+  std::atomic<int> prefetch_msec_;
+  // 展開したバッファの大きさ(先読みしたものを含む)
+  //   TIPS:先読みと再生で同じ上限を使うため、両方のスレッドから増減する
+  std::atomic<size_t> resident_bytes_;
 
-  void setupBufferPlayer(const ci::JsonTree& params,
-                         ci::audio::Context* ctx,
-                         const ci::audio::SourceFileRef& source) {
-    auto buffer = source->loadBuffer();
-    
-    const auto& name = params.getValueForKey<std::string>("name");
-    buffer_.insert(std::make_pair(name, buffer));
-
-    const auto& category = params.getValueForKey<std::string>("category");
-    if (!file_node_.count(category)) {
-      // TIPS:SPECIFIEDにしないと、STEREOの音源を直接MONO出力できない
-      ci::audio::Node::Format format;
-      format.channelMode(ci::audio::Node::ChannelMode::SPECIFIED);
-      auto node = ctx->makeNode(new ci::audio::BufferPlayerNode(format));
-      
-      buffer_node_.insert(std::make_pair(category, node));
-      category_node_.insert(std::make_pair(category, node));
-    }
+  Stats stats_;
+
+
+  static size_t getBytes(const ci::audio::BufferRef& buffer) {
+    return buffer->getNumFrames() * buffer->getNumChannels() * sizeof(float);
+  }
+
+  ci::audio::SourceFileRef openSource(const std::string& file) const {
+    return ci::audio::load(Asset::load(file), sample_rate_);
   }
 
-  void setupFilePlayer(const ci::JsonTree& params,
-                       ci::audio::Context* ctx,
-                       const ci::audio::SourceFileRef& source) {
+  bool isLong(const ci::audio::SourceFileRef& source) const {
+    return source->getNumFrames() > (stream_seconds_ * source->getSampleRate());
+  }
+
+  void addStream(const std::string& name, const ci::audio::SourceFileRef& source) {
     // TIPS:初期値より増やしておかないと、処理負荷で音が切れる
     source->setMaxFramesPerRead(8192);
-
-    const auto& name = params.getValueForKey<std::string>("name");
     source_.insert(std::make_pair(name, source));
+  }
+
+
+  // 上限に収まるなら、その分を使用中として数える
+  bool reserveBytes(const size_t size) {
+    size_t bytes = resident_bytes_;
+    do {
+      if ((bytes + size) > budget_bytes_) return false;
+    } while (!resident_bytes_.compare_exchange_weak(bytes, bytes + size));
+    return true;
+  }
+
+
+  // 優先度の高い順に展開
+  //   TIPS:上限を超える分や長いサウンドは展開しない
+  //        展開した分はresident_bytes_に数え、再生するまでは捨てない
+  void prefetch(std::vector<AudioInfo> infos) {
+    std::stable_sort(std::begin(infos), std::end(infos),
+                     [](const AudioInfo& a, const AudioInfo& b) {
+                       return a.priority > b.priority;
+                     });
+
+    ScopedTiming prefetch_timing("audio prefetch");
+
+    for (const auto& info : infos) {
+      if (quit_) return;
+
+      ScopedTiming timing("audio " + info.file);
+      ci::Timer timer(true);
+      try {
+        auto source = openSource(info.file);
+        if (isLong(source)) continue;
+
+        // TIPS:loadBufferはこの大きさのバッファを作る
+        size_t size = source->getNumFrames() * source->getNumChannels() * sizeof(float);
+        if (!reserveBytes(size)) continue;
+
+        try {
+          prefetched_.store(info.file, source->loadBuffer());
+        }
+        catch (...) {
+          resident_bytes_ -= size;
+          throw;
+        }
+      }
+      catch (const std::exception& e) {
+        DOUT << "audio prefetch failed: " << info.file << " " << e.what() << std::endl;
+        continue;
+      }
+
+      prefetched_num_ += 1;
+      prefetch_msec_  += int(timer.getSeconds() * 1000.0);
+    }
+  }
+
+
+  // 効果音のバッファを用意する(長いサウンドはnullptr)
+  ci::audio::BufferRef findBuffer(const std::string& name, const AudioInfo& info) {
+    auto it = buffer_.find(name);
+    if (it != std::end(buffer_)) {
+      lru_.splice(std::begin(lru_), lru_, it->second.lru);
+      return it->second.buffer;
+    }
+    // 長いサウンドと分かっているものは開き直さない
+    if (source_.count(name)) return nullptr;
+
+    // 先読みしたものは展開した時に数えてある
+    ci::audio::BufferRef buffer;
+    bool prefetched = prefetched_.take(info.file, buffer);
+    if (!prefetched) {
+      ScopedTiming timing("audio " + info.file);
+      ci::Timer timer(true);
+
+      auto source = openSource(info.file);
+      if (isLong(source)) {
+        addStream(name, source);
+        return nullptr;
+      }
+
+      buffer = source->loadBuffer();
+      stats_.decoded_num += 1;
+      stats_.decode_time += timer.getSeconds();
+    }
+
+    lru_.push_front(name);
+    Buffer entry = { buffer, getBytes(buffer), std::begin(lru_) };
+    buffer_.insert(std::make_pair(name, entry));
+    if (!prefetched) resident_bytes_ += entry.bytes;
+
+    evict();
+    return buffer;
+  }
+
+  // 上限を超えていたら、長く使っていないものから捨てる
+  //   TIPS:再生中のものは、ノードが参照しているので捨てない
+  void evict() {
+    auto it = std::end(lru_);
+    while ((resident_bytes_ > budget_bytes_) && (it != std::begin(lru_))) {
+      --it;
+
+      auto& entry = buffer_.at(*it);
+      if (entry.buffer.use_count() > 1) continue;
 
-    const auto& category = params.getValueForKey<std::string>("category");
-    if (!file_node_.count(category)) {
-      // TIPS:SPECIFIEDにしないと、STEREOの音源を直接MONO出力できない
-      ci::audio::Node::Format format;
-      format.channelMode(ci::audio::Node::ChannelMode::SPECIFIED);
-      auto node = ctx->makeNode(new ci::audio::FilePlayerNode(format));
-      
-      file_node_.insert(std::make_pair(category, node));
-      category_node_.insert(std::make_pair(category, node));
+      resident_bytes_ -= entry.bytes;
+      stats_.evicted_num += 1;
+      buffer_.erase(*it);
+      it = lru_.erase(it);
     }
   }
 
-  
+
+  template <typename T>
+  std::shared_ptr<T> getNode(std::map<std::string, std::shared_ptr<T>>& nodes, const std::string& category) {
+    auto it = nodes.find(category);
+    if (it != std::end(nodes)) return it->second;
+
+    // TIPS:SPECIFIEDにしないと、STEREOの音源を直接MONO出力できない
+    ci::audio::Node::Format format;
+    format.channelMode(ci::audio::Node::ChannelMode::SPECIFIED);
+    auto node = ci::audio::Context::master()->makeNode(new T(format));
+
+    nodes.insert(std::make_pair(category, node));
+    return node;
+  }
+
+
+  // 同じカテゴリーで鳴っているのを止めて、次に止める対象にする
+  void switchNode(const std::string& category, const ci::audio::SamplePlayerNodeRef& node) {
+    auto it = category_node_.find(category);
+    if ((it != std::end(category_node_)) && it->second->isEnabled()) {
+      it->second->stop();
+    }
+    category_node_[category] = node;
+  }
+
+
+  void playBuffer(const ci::audio::BufferRef& buffer, const AudioInfo& info) {
+    auto node = getNode(buffer_node_, info.category);
+    switchNode(info.category, node);
+
+    node->setBuffer(buffer);
+    node->setLoopEnabled(info.loop);
+
+    node >> ci::audio::Context::master()->getOutput();
+    node->start();
+  }
+
+  void playFile(const std::string& name, const AudioInfo& info) {
+    if (!source_.count(name)) {
+      addStream(name, openSource(info.file));
+    }
+    auto& source = source_.at(name);
+
+    auto node = getNode(file_node_, info.category);
+    switchNode(info.category, node);
+
+    node->setSourceFile(source);
+    node->setLoopEnabled(info.loop);
+
+    node >> ci::audio::Context::master()->getOutput();
+    node->start();
+
+    stats_.streamed_num += 1;
+  }
+
+
 public:
-  Audio(const ci::JsonTree& params) {
+  Audio(const ci::JsonTree& params, const ci::JsonTree& cache_params)
+    : budget_bytes_(cache_params.getValueForKey<size_t>("budget")),
+      stream_seconds_(cache_params.getValueForKey<double>("stream_seconds")),
+      quit_(false),
+      prefetched_num_(0),
+      prefetch_msec_(0),
+      resident_bytes_(0)
+  {
     auto* ctx = ci::audio::Context::master();
     ctx->enable();
+    sample_rate_ = ctx->getSampleRate();
 
-    std::map<std::string,
-             std::function<void (const ci::JsonTree&,
-                                 ci::audio::Context*,
-                                 const ci::audio::SourceFileRef&)>> creator = {
-      {
-        "se",
-        std::bind(&Audio::setupBufferPlayer,
-                  this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)
-      },
-      {
-        "bgm",
-        std::bind(&Audio::setupFilePlayer,
-                  this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)
-      },
-    };
-    
+    std::vector<AudioInfo> prefetch;
     for (const auto& p : params) {
-      const auto& file = p.getValueForKey<std::string>("file");
-      auto source = ci::audio::load(Asset::load(file), ctx->getSampleRate());
-
-      const auto& type = p.getValueForKey<std::string>("type");
-      creator.at(type)(p, ctx, source);
-      
       AudioInfo info = {
         p.getValueForKey<std::string>("type"),
         p.getValueForKey<std::string>("category"),
         p.getValueForKey<bool>("looping"),
+        p.getValueForKey<std::string>("file"),
+        p.getValueForKey<int>("priority"),
       };
 
       const auto& name = p.getValueForKey<std::string>("name");
       infos_.insert(std::make_pair(name, info));
+
+      if ((info.type == "se") && (info.priority > 0)) {
+        prefetch.push_back(info);
+      }
     }
+
+    prefetch_thread_ = std::thread(&Audio::prefetch, this, prefetch);
   }
 
   ~Audio() {
+    quit_ = true;
+    prefetch_thread_.join();
+
     auto* ctx = ci::audio::Context::master();
     ctx->disable();
     ctx->disconnectAllNodes();
@@ -125,50 +319,16 @@ public:
 
 
   void play(const std::string& name) {
-    std::map<std::string,
-             std::function<void (const std::string&, const AudioInfo&)>> assign = {
-      {
-        "se",
-        [this](const std::string& name, const AudioInfo& info) {
-          auto& buffer = buffer_.at(name);
-          auto& node   = buffer_node_.at(info.category);
-
-          if (node->isEnabled()) {
-            node->stop();
-          }
-          
-          auto* ctx = ci::audio::Context::master();
-
-          node->setBuffer(buffer);
-          node->setLoopEnabled(info.loop);
-          
-          node >> ctx->getOutput();
-          node->start();
-        }
-      },
-      {
-        "bgm",
-        [this](const std::string& name, const AudioInfo& info) {
-          auto& source = source_.at(name);
-          auto& node   = file_node_.at(info.category);
-          
-          if (node->isEnabled()) {
-            node->stop();
-          }
-          
-          auto* ctx = ci::audio::Context::master();
-
-          node->setSourceFile(source);
-          node->setLoopEnabled(info.loop);
-
-          node >> ctx->getOutput();
-          node->start();
-        }
-      },
-    };
-    
     const auto& info = infos_.at(name);
-    assign.at(info.type)(name, info);
+
+    if (info.type == "se") {
+      if (auto buffer = findBuffer(name, info)) {
+        playBuffer(buffer, info);
+        return;
+      }
+    }
+
+    playFile(name, info);
   }
 
   void stopAll() {
@@ -179,6 +339,27 @@ public:
     }
   }
 
+
+  Stats getStats() const {
+    Stats stats = stats_;
+    stats.prefetched_num = prefetched_num_;
+    stats.prefetch_time  = prefetch_msec_ / 1000.0;
+    stats.resident_bytes = resident_bytes_;
+    return stats;
+  }
+
+  void reportStats() const {
+    auto stats = getStats();
+
+    DOUT << "audio:"
+         << " prefetched " << stats.prefetched_num << " (" << stats.prefetch_time * 1000.0 << " ms)"
+         << " decoded " << stats.decoded_num << " (" << stats.decode_time * 1000.0 << " ms)"
+         << " streamed " << stats.streamed_num
+         << " evicted " << stats.evicted_num
+         << " resident " << stats.resident_bytes << "/" << budget_bytes_ << " bytes"
+         << std::endl;
+  }
+
 };
 
 }
@@ -145,25 +145,17 @@ private:
       break;
     }
 
-    if ((key_chara < '0') || (key_chara > '9')) {
-      // JsonTree::hasChild では数字の場合に自動的にインデックス値
-      // で判断してくれるので、数字キーは除外してから処理
-
-      const auto& params = worker_->getParams();
-      
-      // paramsに書かれたsignalを発生
-      // TIPS:大文字小文字の区別をしている
-      auto debug_signal = std::string(1, key_chara);
-      if (params["debug_signal"].hasChild(debug_signal, true)) {
-        auto message = params.getValueForKey<std::string>("debug_signal." + debug_signal, true);
-        
-        DOUT << "debug-signal: "
-             << debug_signal
-             << " "
-             << message << std::endl;
-      
-        worker_->getEvent().signal(message);
-      }
+    // paramsに書かれたsignalを発生
+    // TIPS:大文字小文字の区別をしている
+    const auto& debug_signal = worker_->getParams().debug_signal;
+    auto it = debug_signal.find(key_chara);
+    if (it != std::end(debug_signal)) {
+      DOUT << "debug-signal: "
+           << key_chara
+           << " "
+           << it->second << std::endl;
+
+      worker_->getEvent().signal(it->second);
     }
   }
   
@@ -190,15 +182,15 @@ private:
 // アプリのラウンチコード
 CINDER_APP(ngs::App, ci::app::RendererGl(ci::app::RendererGl::Options().msaa(0)),
            [](ci::app::App::Settings* settings) {
-             // FIXME:ここで設定ファイルを読むなんて...
-             auto params = ngs::Params::load("params.json");
+             // TIPS:ここで読み込んだものをWorkerでも使う
+             const auto& params = ngs::Params::get().app;
 
-             settings->setWindowSize(ngs::Json::getVec<ci::ivec2>(params["app.size"]));
+             settings->setWindowSize(params.size);
              
              settings->setMultiTouchEnabled();
-             settings->setPowerManagementEnabled(params.getValueForKey<bool>("app.power_management"));
-             settings->setHighDensityDisplayEnabled(params.getValueForKey<bool>("app.high_density_display"));
-             settings->setFrameRate(params.getValueForKey<int>("app.frame_rate"));
+             settings->setPowerManagementEnabled(params.power_management);
+             settings->setHighDensityDisplayEnabled(params.high_density_display);
+             settings->setFrameRate(params.frame_rate);
              settings->setTitle(PREPRO_TO_STR(PRODUCT_NAME));
              
              // settings->disableFrameRate();
@@ -0,0 +1,317 @@
+﻿#pragma once
+
+//
+// 変換済みメッシュ
+//   OBJ・PLYを頂点属性を並べたバイナリに変換しておき、実行時はそのままGPUへ転送する
+//   元ファイルより古い場合は使わず、テキストから読み込む
+//
+//   ファイルの構成
+//     Header
+//     頂点データ(stride * vertex_num)
+//     インデックス(uint32_t * index_num)
+//
+
+#include <cinder/ObjLoader.h>
+#include <cinder/TriMesh.h>
+#include <cinder/Timer.h>
+#include <cinder/gl/VboMesh.h>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Asset.hpp"
+#include "MappedFile.hpp"
+#include "PLY.hpp"
+
+
+namespace ngs { namespace CookedMesh {
+
+enum {
+  VERSION = 1,
+};
+
+// 頂点属性
+enum Attribute {
+  POSITION    = 1 << 0,
+  NORMAL      = 1 << 1,
+  TEX_COORD_0 = 1 << 2,
+  COLOR       = 1 << 3,
+};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+
+  // 変換元の大きさと更新日時
+  uint64_t source_size;
+  int64_t  source_time;
+
+  uint32_t attributes;
+  uint32_t stride;
+  uint32_t vertex_num;
+  uint32_t index_num;
+
+  float bounds_min[3];
+  float bounds_max[3];
+};
+
+// 読み込みの統計
+struct Stats {
+  int cooked_num    = 0;
+  int text_num      = 0;
+  double cooked_time = 0.0;
+  double text_time   = 0.0;
+};
+
+Stats& getStats() {
+  static Stats stats;
+  return stats;
+}
+
+
+// 変換済みファイルの場所
+//   TIPS:"relic.obj" → "relic.obj.mesh"
+std::string getCookedName(const std::string& path) {
+  return path + ".mesh";
+}
+
+// テキスト形式のメッシュを読み込む
+ci::TriMesh loadText(const std::string& path) {
+  ScopedTiming timing("parse " + path);
+
+  if (ci::fs::path(path).extension() == ".ply") {
+    return PLY::load(path);
+  }
+
+  ci::ObjLoader loader(Asset::load(path));
+  ci::TriMesh mesh(loader);
+  if (!mesh.hasNormals()) {
+    mesh.recalculateNormals();
+  }
+  return mesh;
+}
+
+
+// 変換してassetsへ書き出す
+bool cook(const std::string& path) {
+  auto source = getAssetPath(path);
+  if (source.empty() || !ci::fs::exists(source)) return false;
+
+  ci::TriMesh mesh = loadText(path);
+  size_t vertex_num = mesh.getNumVertices();
+  if (vertex_num == 0) return false;
+
+  Header header;
+  std::memcpy(header.magic, "NGSM", 4);
+  header.version     = VERSION;
+  header.source_size = uint64_t(ci::fs::file_size(source));
+  header.source_time = int64_t(ci::fs::last_write_time(source));
+
+  bool has_tex_coords = mesh.hasTexCoords0() && (mesh.getAttribDims(ci::geom::Attrib::TEX_COORD_0) == 2);
+  bool has_colors     = mesh.hasColors();
+
+  header.attributes = POSITION | NORMAL;
+  header.stride     = sizeof(float) * 6;
+  if (has_tex_coords) {
+    header.attributes |= TEX_COORD_0;
+    header.stride     += sizeof(float) * 2;
+  }
+  if (has_colors) {
+    header.attributes |= COLOR;
+    header.stride     += sizeof(float) * 4;
+  }
+
+  auto bounds = mesh.calcBoundingBox();
+  for (int i = 0; i < 3; ++i) {
+    header.bounds_min[i] = bounds.getMin()[i];
+    header.bounds_max[i] = bounds.getMax()[i];
+  }
+
+  // 頂点属性を並べる
+  std::vector<float> vertices;
+  vertices.reserve(vertex_num * header.stride / sizeof(float));
+
+  const auto* positions = mesh.getPositions<3>();
+  const auto& normals   = mesh.getNormals();
+  const auto& colors    = mesh.getBufferColors();
+  size_t color_dims     = has_colors ? mesh.getAttribDims(ci::geom::Attrib::COLOR) : 0;
+  for (size_t i = 0; i < vertex_num; ++i) {
+    vertices.insert(std::end(vertices), { positions[i].x, positions[i].y, positions[i].z });
+    vertices.insert(std::end(vertices), { normals[i].x, normals[i].y, normals[i].z });
+    if (has_tex_coords) {
+      const auto& uv = mesh.getTexCoords0<2>()[i];
+      vertices.insert(std::end(vertices), { uv.x, uv.y });
+    }
+    if (has_colors) {
+      for (size_t c = 0; c < 4; ++c) {
+        vertices.push_back((c < color_dims) ? colors[i * color_dims + c] : 1.0f);
+      }
+    }
+  }
+
+  std::vector<uint32_t> indices = mesh.getIndices();
+  if (indices.empty()) {
+    // インデックスの無いメッシュは頂点順に並べる
+    for (size_t i = 0; i < vertex_num; ++i) {
+      indices.push_back(uint32_t(i));
+    }
+  }
+
+  header.vertex_num = uint32_t(vertex_num);
+  header.index_num  = uint32_t(indices.size());
+
+  auto cooked = source.parent_path() / getCookedName(source.filename().string());
+  std::ofstream ofs(cooked.string(), std::ios::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(&vertices[0]), vertices.size() * sizeof(float));
+  ofs.write(reinterpret_cast<const char*>(&indices[0]), indices.size() * sizeof(uint32_t));
+
+  return bool(ofs);
+}
+
+// assets内の全てのOBJ・PLYを変換
+void cookAll() {
+  auto directory = getAssetPath("ship.ply").parent_path();
+
+  for (ci::fs::directory_iterator it(directory), end; it != end; ++it) {
+    const auto& path = it->path();
+    if ((path.extension() != ".obj") && (path.extension() != ".ply")) continue;
+
+    auto name = path.filename().string();
+    bool result = cook(name);
+    DOUT << "cook: " << name << (result ? " done" : " failed") << std::endl;
+  }
+}
+
+
+// 変換済みファイルがあるか
+bool hasCooked(const std::string& path) {
+  const uint8_t* data;
+  size_t size;
+  if (getAssetPack().findRaw(getCookedName(path), data, size)) return true;
+
+  auto cooked = getAssetPath(getCookedName(path));
+  return !cooked.empty() && ci::fs::exists(cooked);
+}
+
+
+// 変換済みファイルからメッシュを作る(使えなければnullptr)
+//   アセットパックに入っていればそれを、無ければ個別のファイルをマップして使う
+ci::gl::VboMeshRef createFromCooked(const std::string& path, ci::AxisAlignedBox& bounds) {
+  const uint8_t* file_data = nullptr;
+  size_t file_size = 0;
+
+  std::unique_ptr<MappedFile> file;
+  if (!getAssetPack().findRaw(getCookedName(path), file_data, file_size)) {
+    auto cooked = getAssetPath(getCookedName(path));
+    if (cooked.empty() || !ci::fs::exists(cooked)) return nullptr;
+
+    file.reset(new MappedFile(cooked));
+    if (!file->isOpen()) return nullptr;
+    file_data = file->getData();
+    file_size = file->getSize();
+  }
+  if (file_size < sizeof(Header)) return nullptr;
+
+  Header header;
+  std::memcpy(&header, file_data, sizeof(header));
+  if ((std::memcmp(header.magic, "NGSM", 4) != 0) || (header.version != VERSION)) return nullptr;
+
+  size_t vertex_bytes = size_t(header.stride) * header.vertex_num;
+  size_t index_bytes  = sizeof(uint32_t) * header.index_num;
+  if (file_size < (sizeof(Header) + vertex_bytes + index_bytes)) return nullptr;
+
+  // 元ファイルが更新されていたら使わない
+  // TIPS:元ファイルを同梱しない場合は、変換済みファイルをそのまま使う
+  auto source = getAssetPath(path);
+  if (!source.empty() && ci::fs::exists(source)) {
+    if ((header.source_size != uint64_t(ci::fs::file_size(source)))
+        || (header.source_time != int64_t(ci::fs::last_write_time(source)))) {
+      DOUT << "cooked mesh is stale: " << path << std::endl;
+      return nullptr;
+    }
+  }
+
+  ci::geom::BufferLayout layout;
+  size_t offset = 0;
+  layout.append(ci::geom::Attrib::POSITION, 3, header.stride, offset);
+  offset += sizeof(float) * 3;
+  layout.append(ci::geom::Attrib::NORMAL, 3, header.stride, offset);
+  offset += sizeof(float) * 3;
+  if (header.attributes & TEX_COORD_0) {
+    layout.append(ci::geom::Attrib::TEX_COORD_0, 2, header.stride, offset);
+    offset += sizeof(float) * 2;
+  }
+  if (header.attributes & COLOR) {
+    layout.append(ci::geom::Attrib::COLOR, 4, header.stride, offset);
+  }
+
+  // マップした領域から直接GPUへ転送する
+  const uint8_t* data = file_data + sizeof(Header);
+  auto vbo = ci::gl::Vbo::create(GL_ARRAY_BUFFER, vertex_bytes, data, GL_STATIC_DRAW);
+  auto ibo = ci::gl::Vbo::create(GL_ELEMENT_ARRAY_BUFFER, index_bytes, data + vertex_bytes, GL_STATIC_DRAW);
+
+  bounds = ci::AxisAlignedBox(ci::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]),
+                              ci::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]));
+
+  return ci::gl::VboMesh::create(header.vertex_num, GL_TRIANGLES, { { layout, vbo } },
+                                 header.index_num, GL_UNSIGNED_INT, ibo);
+}
+
+
+Asset::Cache<ci::TriMesh>& getTextCache() {
+  static Asset::Cache<ci::TriMesh> cache;
+  return cache;
+}
+
+// 変換済みファイルが無いメッシュを先に解析しておく(別スレッドから呼ぶ)
+//   TIPS:変換済みファイルはマップしてそのまま転送するだけなので、先読みしない
+void preload(const std::string& path) {
+  if (hasCooked(path)) return;
+
+  getTextCache().store(path, loadText(path));
+}
+
+
+// メッシュを読み込む
+//   変換済みファイルがあればそれを使い、無ければテキストから読み込む
+ci::gl::VboMeshRef load(const std::string& path, ci::AxisAlignedBox& bounds) {
+  ScopedTiming timing("mesh " + path);
+  auto& stats = getStats();
+  ci::Timer timer(true);
+
+  if (auto mesh = createFromCooked(path, bounds)) {
+    stats.cooked_num  += 1;
+    stats.cooked_time += timer.getSeconds();
+    return mesh;
+  }
+
+  ci::TriMesh mesh(ci::TriMesh::Format().positions());
+  if (!getTextCache().take(path, mesh)) {
+    mesh = loadText(path);
+  }
+  bounds = mesh.calcBoundingBox();
+  auto vbo_mesh = ci::gl::VboMesh::create(mesh);
+
+  stats.text_num  += 1;
+  stats.text_time += timer.getSeconds();
+  return vbo_mesh;
+}
+
+ci::gl::VboMeshRef load(const std::string& path) {
+  ci::AxisAlignedBox bounds;
+  return load(path, bounds);
+}
+
+
+// 読み込みの統計を出力
+void reportStats() {
+  const auto& stats = getStats();
+
+  DOUT << "mesh:"
+       << " cooked " << stats.cooked_num << " (" << stats.cooked_time * 1000.0 << " ms)"
+       << " text " << stats.text_num << " (" << stats.text_time * 1000.0 << " ms)"
+       << std::endl;
+}
+
+} }
@@ -0,0 +1,316 @@
+﻿#pragma once
+
+//
+// 変換済みテクスチャ
+//   PNGを展開済みの画素とミップマップを並べたKTXに変換しておき、実行時はそのままGPUへ転送する
+//   使う分だけのチャンネル数にして、テクスチャのメモリを減らす
+//   変換済みファイルが無いか、記録した元ファイルの大きさ・更新日時が違う場合は、PNGから読み込む
+//
+//   TIPS:圧縮形式はデスクトップ(GL3.3)とiOS(ES3.0)で共通に使えるものが無いので、非圧縮で格納する
+//
+//   SOURCE:https://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/
+//
+
+#include <cinder/gl/Texture.h>
+#include <cinder/ImageIo.h>
+#include <cinder/Timer.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Asset.hpp"
+#include "MappedFile.hpp"
+
+
+namespace ngs { namespace CookedTexture {
+
+struct KtxHeader {
+  uint8_t identifier[12];
+  uint32_t endianness;
+  uint32_t gl_type;
+  uint32_t gl_type_size;
+  uint32_t gl_format;
+  uint32_t gl_internal_format;
+  uint32_t gl_base_internal_format;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t number_of_array_elements;
+  uint32_t number_of_faces;
+  uint32_t number_of_mipmap_levels;
+  uint32_t bytes_of_key_value_data;
+};
+
+// 変換元の大きさと更新日時
+//   TIPS:KTXのキーと値の領域に格納する
+struct SourceInfo {
+  uint64_t size;
+  int64_t  time;
+};
+
+const char SOURCE_KEY[] = "NGSSource";
+
+// キーと値の領域の大きさ(4バイト境界に揃える)
+enum {
+  KEY_VALUE_SIZE = sizeof(uint32_t) + ((sizeof(SOURCE_KEY) + sizeof(SourceInfo) + 3) & ~3),
+};
+
+
+// 読み込みの統計
+struct Stats {
+  int cooked_num     = 0;
+  int decoded_num    = 0;
+  double cooked_time  = 0.0;
+  double decoded_time = 0.0;
+  // GPUへ転送した大きさ
+  size_t texture_bytes = 0;
+};
+
+Stats& getStats() {
+  static Stats stats;
+  return stats;
+}
+
+
+// 変換済みファイルの場所
+//   TIPS:"water_normal.png" → "water_normal.png.ktx"
+std::string getCookedName(const std::string& path) {
+  return path + ".ktx";
+}
+
+// 変換済みファイルに記録した変換元の情報を読み取る
+bool readSourceInfo(const uint8_t* data, const size_t size, SourceInfo& info) {
+  if (size < sizeof(KtxHeader)) return false;
+
+  KtxHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (header.bytes_of_key_value_data > (size - sizeof(KtxHeader))) return false;
+
+  const uint8_t* key_value = data + sizeof(KtxHeader);
+  size_t offset = 0;
+  while ((offset + sizeof(uint32_t)) <= header.bytes_of_key_value_data) {
+    uint32_t pair_size;
+    std::memcpy(&pair_size, key_value + offset, sizeof(pair_size));
+    offset += sizeof(pair_size);
+    if (pair_size > (header.bytes_of_key_value_data - offset)) return false;
+
+    if ((pair_size == (sizeof(SOURCE_KEY) + sizeof(SourceInfo)))
+        && (std::memcmp(key_value + offset, SOURCE_KEY, sizeof(SOURCE_KEY)) == 0)) {
+      std::memcpy(&info, key_value + offset + sizeof(SOURCE_KEY), sizeof(info));
+      return true;
+    }
+    offset += (pair_size + 3) & ~size_t(3);
+  }
+  return false;
+}
+
+// 変換済みファイルが使えるか
+//   元ファイルがあれば、記録した大きさと更新日時が一致するものだけ使う
+//   TIPS:CookedMeshと同じ判定。元ファイルを同梱しない場合は、変換済みファイルをそのまま使う
+bool hasCooked(const std::string& path) {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+
+  std::unique_ptr<MappedFile> file;
+  if (!getAssetPack().findRaw(getCookedName(path), data, size)) {
+    auto cooked = getAssetPath(getCookedName(path));
+    if (cooked.empty() || !ci::fs::exists(cooked)) return false;
+
+    file.reset(new MappedFile(cooked));
+    if (!file->isOpen()) return false;
+    data = file->getData();
+    size = file->getSize();
+  }
+
+  auto source = getAssetPath(path);
+  if (!source.empty() && ci::fs::exists(source)) {
+    SourceInfo info;
+    if (!readSourceInfo(data, size, info)
+        || (info.size != uint64_t(ci::fs::file_size(source)))
+        || (info.time != int64_t(ci::fs::last_write_time(source)))) {
+      DOUT << "cooked texture is stale: " << path << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// 縦横半分に縮小(2x2の平均)
+std::vector<uint8_t> downsample(const std::vector<uint8_t>& pixels,
+                                const int width, const int height, const int channels) {
+  int w = std::max(width / 2, 1);
+  int h = std::max(height / 2, 1);
+
+  std::vector<uint8_t> result(w * h * channels);
+  for (int y = 0; y < h; ++y) {
+    int y0 = std::min(y * 2, height - 1);
+    int y1 = std::min(y * 2 + 1, height - 1);
+    for (int x = 0; x < w; ++x) {
+      int x0 = std::min(x * 2, width - 1);
+      int x1 = std::min(x * 2 + 1, width - 1);
+      for (int c = 0; c < channels; ++c) {
+        int sum = pixels[(y0 * width + x0) * channels + c]
+                + pixels[(y0 * width + x1) * channels + c]
+                + pixels[(y1 * width + x0) * channels + c]
+                + pixels[(y1 * width + x1) * channels + c];
+        result[(y * w + x) * channels + c] = uint8_t((sum + 2) / 4);
+      }
+    }
+  }
+
+  return result;
+}
+
+
+// 変換してassetsへ書き出す
+//   channels 残すチャンネル数(1~4)
+//   mipmap   ミップマップを作るならtrue
+bool cook(const std::string& path, const int channels, const bool mipmap) {
+  auto source = getAssetPath(path);
+  if (source.empty() || !ci::fs::exists(source) || (channels < 1) || (channels > 4)) return false;
+
+  ci::Surface8u surface(ci::loadImage(ci::loadFile(source)));
+  int width  = surface.getWidth();
+  int height = surface.getHeight();
+
+  std::vector<uint8_t> pixels;
+  pixels.reserve(width * height * channels);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      auto color = surface.getPixel(ci::ivec2(x, y));
+      const uint8_t rgba[] = { color.r, color.g, color.b, color.a };
+      pixels.insert(std::end(pixels), rgba, rgba + channels);
+    }
+  }
+
+  const GLenum formats[][2] = {
+    { GL_RED,  GL_R8 },
+    { GL_RG,   GL_RG8 },
+    { GL_RGB,  GL_RGB8 },
+    { GL_RGBA, GL_RGBA8 },
+  };
+
+  int levels = 1;
+  if (mipmap) {
+    while ((std::max(width, height) >> (levels - 1)) > 1) levels += 1;
+  }
+
+  KtxHeader header = {
+    { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A },
+    0x04030201,
+    GL_UNSIGNED_BYTE, 1,
+    formats[channels - 1][0], formats[channels - 1][1], formats[channels - 1][0],
+    uint32_t(width), uint32_t(height), 0,
+    0, 1, uint32_t(levels),
+    KEY_VALUE_SIZE,
+  };
+
+  auto cooked = source.parent_path() / getCookedName(source.filename().string());
+  std::ofstream ofs(cooked.string(), std::ios::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // 変換元の情報
+  {
+    SourceInfo info = {
+      uint64_t(ci::fs::file_size(source)),
+      int64_t(ci::fs::last_write_time(source)),
+    };
+    uint32_t pair_size = uint32_t(sizeof(SOURCE_KEY) + sizeof(info));
+    ofs.write(reinterpret_cast<const char*>(&pair_size), sizeof(pair_size));
+    ofs.write(SOURCE_KEY, sizeof(SOURCE_KEY));
+    ofs.write(reinterpret_cast<const char*>(&info), sizeof(info));
+
+    const char padding[4] = {};
+    ofs.write(padding, KEY_VALUE_SIZE - sizeof(pair_size) - pair_size);
+  }
+
+  for (int level = 0; level < levels; ++level) {
+    // TIPS:各行は4バイト境界に揃える
+    size_t row_bytes  = width * channels;
+    size_t row_stride = (row_bytes + 3) & ~size_t(3);
+    uint32_t image_size = uint32_t(row_stride * height);
+    ofs.write(reinterpret_cast<const char*>(&image_size), sizeof(image_size));
+
+    const char padding[4] = {};
+    for (int y = 0; y < height; ++y) {
+      ofs.write(reinterpret_cast<const char*>(&pixels[y * row_bytes]), row_bytes);
+      ofs.write(padding, row_stride - row_bytes);
+    }
+
+    if ((level + 1) < levels) {
+      pixels = downsample(pixels, width, height, channels);
+      width  = std::max(width / 2, 1);
+      height = std::max(height / 2, 1);
+    }
+  }
+
+  return bool(ofs);
+}
+
+// paramsに書かれたテクスチャを全て変換
+void cookAll(const ci::JsonTree& params) {
+  for (const auto& p : params) {
+    const auto& file = p.getValueForKey<std::string>("file");
+    bool result = cook(file, p.getValueForKey<int>("channels"), p.getValueForKey<bool>("mipmap"));
+    DOUT << "cook: " << file << (result ? " done" : " failed") << std::endl;
+  }
+}
+
+
+// 変換済みファイルが無いものを先に展開しておく(別スレッドから呼ぶ)
+void preload(const std::string& path) {
+  if (hasCooked(path)) return;
+
+  Asset::preloadImage(path);
+}
+
+
+// テクスチャを読み込む
+//   変換済みファイルがあればそれを使い、無ければPNGから読み込む
+//   TIPS:変換済みファイルにミップマップが無い場合、formatの指定でGPUで生成する
+ci::gl::Texture2dRef load(const std::string& path, const ci::gl::Texture2d::Format& format) {
+  ScopedTiming timing("texture " + path);
+  auto& stats = getStats();
+  ci::Timer timer(true);
+
+  if (hasCooked(path)) {
+    try {
+      auto source  = Asset::load(getCookedName(path));
+      size_t bytes = source->getBuffer()->getSize() - sizeof(KtxHeader) - KEY_VALUE_SIZE;
+      auto texture = ci::gl::Texture2d::createFromKtx(source, format);
+
+      stats.cooked_num    += 1;
+      stats.cooked_time   += timer.getSeconds();
+      stats.texture_bytes += bytes;
+      return texture;
+    }
+    catch (const std::exception& e) {
+      DOUT << "cooked texture failed: " << path << " " << e.what() << std::endl;
+    }
+  }
+
+  auto surface = Asset::loadImage(path);
+  auto texture = ci::gl::Texture2d::create(surface, format);
+
+  stats.decoded_num  += 1;
+  stats.decoded_time += timer.getSeconds();
+  // TIPS:RGBで読み込んでもGPU側は4バイト境界になることが多いので、4チャンネルで数える
+  stats.texture_bytes += surface.getWidth() * surface.getHeight() * 4;
+  return texture;
+}
+
+
+// 読み込みの統計を出力
+void reportStats() {
+  const auto& stats = getStats();
+
+  DOUT << "texture:"
+       << " cooked " << stats.cooked_num << " (" << stats.cooked_time * 1000.0 << " ms)"
+       << " decoded " << stats.decoded_num << " (" << stats.decoded_time * 1000.0 << " ms)"
+       << " " << stats.texture_bytes << " bytes"
+       << std::endl;
+}
+
+} }
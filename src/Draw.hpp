@@ -2,59 +2,232 @@
 
 //
 // 単純な図形の描画
-// 
-
-
-namespace ngs { namespace Draw {
-
-// 塗り潰し円弧
-// center_x, center_y  円の中心位置
-// radius              半径
-// start_rad, end_rad  開始・終了角度
-// division            円の分割数(数値が大きいと滑らかな円になる)
-// color               色
-void fillArc(const float center_x, const float center_y,
-             const float radius,
-             const float start_rad, const float end_rad,
-             const int division) {
-  // 頂点データを生成
-  std::vector<GLfloat> vtx;
-  vtx.reserve(division * 2);                        // TIPS:正確な値である必要はない
-
-  vtx.push_back(center_x);
-  vtx.push_back(center_y);
-
-  for (int i = 0; i <= division; ++i) {
-    float r = ((end_rad - start_rad) * i) / division + start_rad;
-
-    vtx.push_back(radius * std::sin(r) + center_x);
-    vtx.push_back(radius * std::cos(r) + center_y);
-  }
-
-	auto ctx = ci::gl::context();
-	const auto* curGlslProg = ctx->getGlslProg();
-	if( ! curGlslProg ) {
-		DOUT << "No GLSL program bound" << std::endl;
-		return;
-	}
-
-	ctx->pushVao();
-	ctx->getDefaultVao()->replacementBindBegin();
-
-	auto defaultVbo = ctx->getDefaultArrayVbo(vtx.size() * sizeof(GLfloat));
-  ci::gl::ScopedBuffer vboScp( defaultVbo );
-  
-	int posLoc = curGlslProg->getAttribSemanticLocation( ci::geom::Attrib::POSITION );
-  assert(posLoc >= 0);
-  ci::gl::enableVertexAttribArray( posLoc );
-  ci::gl::vertexAttribPointer( posLoc, 2, GL_FLOAT, GL_FALSE, 0, 0 );
-
-	defaultVbo->bufferSubData( 0, vtx.size() * sizeof(GLfloat), &vtx[0] );
-	ctx->getDefaultVao()->replacementBindEnd();
-
-	ctx->setDefaultShaderVars();
-	ctx->drawArrays( GL_TRIANGLE_FAN, 0, vtx.size() / 2 );
-	ctx->popVao();
-}
+//   1フレーム分の図形をためておき、まとめて転送・描画する
+//   転送先は数フレーム分の領域を順番に使う(リングバッファ)ので、
+//   GPUが前のフレームの描画に使っている領域を書き換えずに済む
+//
+
+#include <cinder/gl/Batch.h>
+#include <cinder/gl/Vbo.h>
+#include <cinder/gl/VboMesh.h>
+#include <cstddef>
+#include <vector>
+
+
+namespace ngs {
+
+class ImmediateDrawer {
+public:
+  struct Vertex {
+    ci::vec3 position;
+    ci::vec4 color;
+  };
+
+  struct Stats {
+    // 1フレームで描画した頂点の数
+    size_t vertex_num = 0;
+    int draw_num      = 0;
+    // 領域が足りずに描画できなかった頂点の数
+    size_t dropped_num = 0;
+  };
+
+
+private:
+  // 1フレーム分の頂点数
+  size_t capacity_;
+  // リングバッファを何フレーム分持つか
+  size_t frame_num_;
+  size_t frame_ = 0;
+
+  // TIPS:三角形は先頭から、線分は末尾から詰める
+  //      転送前に線分を三角形の直後へ移すので、転送は一回で済む
+  std::vector<Vertex> vertices_;
+  size_t triangle_num_ = 0;
+  size_t line_num_     = 0;
+
+  ci::gl::VboRef   vbo_;
+  ci::gl::BatchRef triangles_;
+  ci::gl::BatchRef lines_;
+
+  Stats stats_;
+  size_t dropped_num_ = 0;
+
+
+  ci::gl::BatchRef createBatch(const GLenum primitive, const ci::gl::GlslProgRef& shader) const {
+    ci::geom::BufferLayout layout;
+    layout.append(ci::geom::Attrib::POSITION, 3, sizeof(Vertex), offsetof(Vertex, position));
+    layout.append(ci::geom::Attrib::COLOR,    4, sizeof(Vertex), offsetof(Vertex, color));
+
+    auto mesh = ci::gl::VboMesh::create(uint32_t(capacity_ * frame_num_), primitive, { { layout, vbo_ } });
+    return ci::gl::Batch::create(mesh, shader);
+  }
+
+  // 三角形の領域を確保(確保できなければnullptr)
+  Vertex* allocateTriangles(const size_t num) {
+    if ((triangle_num_ + line_num_ + num) > capacity_) {
+      dropped_num_ += num;
+      return nullptr;
+    }
+
+    Vertex* v = &vertices_[triangle_num_];
+    triangle_num_ += num;
+    return v;
+  }
+
+  Vertex* allocateLines(const size_t num) {
+    if ((triangle_num_ + line_num_ + num) > capacity_) {
+      dropped_num_ += num;
+      return nullptr;
+    }
+
+    line_num_ += num;
+    return &vertices_[capacity_ - line_num_];
+  }
+
+  static ci::vec3 arcPoint(const ci::vec2& center, const float radius, const float rad) {
+    return ci::vec3(radius * std::sin(rad) + center.x, radius * std::cos(rad) + center.y, 0.0f);
+  }
+
+
+public:
+  ImmediateDrawer(const ci::JsonTree& params, const ci::gl::GlslProgRef& shader)
+    : capacity_(std::max(params.getValueForKey<size_t>("vertices"), size_t(6))),
+      frame_num_(std::max(params.getValueForKey<size_t>("frames"), size_t(1))),
+      vertices_(capacity_)
+  {
+    vbo_ = ci::gl::Vbo::create(GL_ARRAY_BUFFER, capacity_ * frame_num_ * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+
+    triangles_ = createBatch(GL_TRIANGLES, shader);
+    lines_     = createBatch(GL_LINES, shader);
+  }
+
+
+  // 塗り潰し円弧
+  // center              円の中心位置
+  // radius              半径
+  // start_rad, end_rad  開始・終了角度
+  // division            円の分割数(数値が大きいと滑らかな円になる)
+  // color               色
+  void fillArc(const ci::vec2& center, const float radius,
+               const float start_rad, const float end_rad,
+               const int division, const ci::ColorA& color) {
+    if (division <= 0) return;
+
+    Vertex* v = allocateTriangles(division * 3);
+    if (!v) return;
 
-} }
+    ci::vec4 c(color.r, color.g, color.b, color.a);
+    ci::vec3 prev = arcPoint(center, radius, start_rad);
+    for (int i = 1; i <= division; ++i) {
+      ci::vec3 p = arcPoint(center, radius, ((end_rad - start_rad) * i) / division + start_rad);
+
+      *v++ = { ci::vec3(center, 0.0f), c };
+      *v++ = { prev, c };
+      *v++ = { p, c };
+      prev = p;
+    }
+  }
+
+  void fillCircle(const ci::vec2& center, const float radius,
+                  const int division, const ci::ColorA& color) {
+    fillArc(center, radius, 0.0f, float(M_PI * 2.0), division, color);
+  }
+
+  // 塗り潰した輪
+  void fillRing(const ci::vec2& center, const float inner_radius, const float outer_radius,
+                const int division, const ci::ColorA& color) {
+    if (division <= 0) return;
+
+    Vertex* v = allocateTriangles(division * 6);
+    if (!v) return;
+
+    ci::vec4 c(color.r, color.g, color.b, color.a);
+    for (int i = 0; i < division; ++i) {
+      float r0 = float(M_PI * 2.0 * i) / division;
+      float r1 = float(M_PI * 2.0 * (i + 1)) / division;
+
+      ci::vec3 i0 = arcPoint(center, inner_radius, r0);
+      ci::vec3 i1 = arcPoint(center, inner_radius, r1);
+      ci::vec3 o0 = arcPoint(center, outer_radius, r0);
+      ci::vec3 o1 = arcPoint(center, outer_radius, r1);
+
+      *v++ = { i0, c };
+      *v++ = { o0, c };
+      *v++ = { o1, c };
+      *v++ = { i0, c };
+      *v++ = { o1, c };
+      *v++ = { i1, c };
+    }
+  }
+
+  // 線分
+  void drawLine(const ci::vec3& start, const ci::vec3& end, const ci::ColorA& color) {
+    Vertex* v = allocateLines(2);
+    if (!v) return;
+
+    ci::vec4 c(color.r, color.g, color.b, color.a);
+    v[0] = { start, c };
+    v[1] = { end, c };
+  }
+
+  // 円周
+  void drawCircle(const ci::vec2& center, const float radius,
+                  const int division, const ci::ColorA& color) {
+    if (division <= 0) return;
+
+    Vertex* v = allocateLines(division * 2);
+    if (!v) return;
+
+    ci::vec4 c(color.r, color.g, color.b, color.a);
+    ci::vec3 prev = arcPoint(center, radius, 0.0f);
+    for (int i = 1; i <= division; ++i) {
+      ci::vec3 p = arcPoint(center, radius, float(M_PI * 2.0 * i) / division);
+
+      *v++ = { prev, c };
+      *v++ = { p, c };
+      prev = p;
+    }
+  }
+
+
+  // ためておいた図形を転送して描画する
+  //   現在の行列とシェーダーの設定で描画されるので、1フレームに1回だけ呼ぶ
+  void flush() {
+    stats_ = Stats();
+    stats_.dropped_num = dropped_num_;
+    dropped_num_ = 0;
+
+    size_t num = triangle_num_ + line_num_;
+    if (num > 0) {
+      // 線分を三角形の直後へ詰める
+      // TIPS:移動先は移動元より前にあるので、先頭から順にコピーしてよい
+      std::copy(std::begin(vertices_) + (capacity_ - line_num_), std::end(vertices_),
+                std::begin(vertices_) + triangle_num_);
+
+      size_t first = (frame_ % frame_num_) * capacity_;
+      vbo_->bufferSubData(first * sizeof(Vertex), num * sizeof(Vertex), &vertices_[0]);
+
+      if (triangle_num_ > 0) {
+        triangles_->draw(GLint(first), GLsizei(triangle_num_));
+        stats_.draw_num += 1;
+      }
+      if (line_num_ > 0) {
+        lines_->draw(GLint(first + triangle_num_), GLsizei(line_num_));
+        stats_.draw_num += 1;
+      }
+      stats_.vertex_num = num;
+    }
+
+    triangle_num_ = 0;
+    line_num_     = 0;
+    frame_ += 1;
+  }
+
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+};
+
+}
@@ -10,12 +10,17 @@
 #include <cinder/Perlin.h>
 #include <cinder/Ray.h>
 #include <cinder/Frustum.h> 
+#include <cinder/Timer.h>
 #include "Asset.hpp"
+#include "CookedTexture.hpp"
 #include "Params.hpp"
 #include "Shader.hpp"
 #include "Holder.hpp"
 #include "StageObj.hpp"
 #include "TiledStage.hpp"
+#include "VisibleSet.hpp"
+#include "RenderQueue.hpp"
+#include "ResolutionGovernor.hpp"
 #include "StageDraw.hpp"
 #include "StageObjDraw.hpp"
 #include "RelicDraw.hpp"
@@ -42,15 +47,13 @@ namespace ngs {
 class Game {
   enum {
     BLOCK_SIZE = 64,
-    
-    FBO_WIDTH  = 512,
-    FBO_HEIGHT = 512,
   };
 
   Event& event_;
   ConnectionHolder holder_;
   
   const ci::JsonTree& params_;
+  const std::vector<Params::Item>& items_;
   
   ci::CameraPersp camera;
 
@@ -92,6 +95,8 @@ class Game {
 
   // 陸地
   TiledStage stage;
+  // 1フレーム中に見えている地形
+  VisibleSet visible_set_;
 
   // 海面
   Sea sea_;
@@ -106,13 +111,57 @@ class Game {
   ci::gl::GlslProgRef	sea_shader_;
   ci::gl::VboMeshRef sea_mesh_;
   
-  ci::gl::FboRef fbo_;
+  // 海面演出用のFBOは負荷に合わせて解像度を変える
+  ResolutionGovernor fbo_governor_;
+  ci::ivec2 fbo_size_;
+  float frame_time_;
+
+  // 景色を一度だけ描画し、海面はそれを参照して重ねる
+  bool single_pass_;
+  // 画面と同じ大きさの描画先(single_pass_の時だけ使う)
+  ci::gl::FboRef scene_fbo_;
   
   StageDrawer stage_drawer_;
   StageObjDrawer stageobj_drawer_;
   RelicDrawer relic_drawer_;
   RouteDrawer route_drawer_;
 
+  // 海面に映り込む景色と、その上に重ねる表示
+  RenderQueue scene_queue_;
+  RenderQueue overlay_queue_;
+  GlRenderBackend render_backend_;
+  // 1フレームの描画命令の実行結果
+  RenderStats render_stats_;
+
+  // 地形の可視判定の結果(毎フレーム更新)
+  int visible_stage_num_;
+  int culled_stage_num_;
+  int generated_stage_num_;
+  size_t last_generated_num_;
+  // 1フレームで描画した地形の三角形の数
+  int stage_triangle_num_;
+  // 転送中のため粗いメッシュで描画した地形の数
+  int coarse_stage_num_;
+  // 1フレームで描画したステージ上の物体の数
+  int stage_obj_num_;
+  // 地形のGPUへの転送量(KB)と時間(ms)
+  float upload_kbytes_;
+  float upload_time_;
+  float pending_upload_kbytes_;
+  // 地形の共有バッファの使用量(KB)
+  float arena_kbytes_;
+  float arena_capacity_kbytes_;
+  int arena_fragment_num_;
+  int arena_rebuild_num_;
+  // 描画命令の実行結果から集計した数
+  int draw_call_num_;
+  int state_change_num_;
+  // 描画命令の発行にかかったCPU時間(ms)
+  float draw_cpu_time_;
+  // UIの図形の頂点数と描画回数
+  int ui_vertex_num_;
+  int ui_draw_num_;
+
   bool picked_;
   ci::AxisAlignedBox picked_aabb_;
   ci::vec3 picked_pos_;
@@ -152,6 +201,8 @@ class Game {
   Light ui_light_;
   
   ci::gl::GlslProgRef ui_shader_;
+  // UIの図形をまとめて描画する
+  ImmediateDrawer ui_drawer_;
 
   PieChart pie_chart_;
 
@@ -180,13 +231,12 @@ class Game {
 
 
   // アイテムゲット用の分布配列を生成
-  static std::vector<double> createItemProbabilities(const ci::JsonTree& params) {
-    int total_num = params["item.body"].getNumChildren();
+  static std::vector<double> createItemProbabilities(const std::vector<Params::Item>& items) {
     std::vector<double> probabilities;
-    probabilities.reserve(total_num);
+    probabilities.reserve(items.size());
 
-    for (const auto& p : params["item.body"]) {
-      probabilities.push_back(p.getValueForKey<double>("probability"));
+    for (const auto& item : items) {
+      probabilities.push_back(item.probability);
     }
 
     return probabilities;
@@ -194,7 +244,9 @@ class Game {
   
 
   void createStage() {
+    visible_set_.clear();
     stage = TiledStage(params_, BLOCK_SIZE, random, random_scale);
+    last_generated_num_ = 0;
     stage_drawer_.clear();
     stageobj_drawer_.clear();
 
@@ -228,57 +280,16 @@ class Game {
     sea_shader_ = createShader("water", "water");
     sea_shader_->uniform("uTex0", 0);
     sea_shader_->uniform("uTex1", 1);
-    sea_texture_ = ci::gl::Texture2d::create(ci::loadImage(Asset::load(params_.getValueForKey<std::string>("sea.wave_texture"))),
-                                             ci::gl::Texture2d::Format().wrap(GL_REPEAT));
+    // TIPS:遠くの海面がちらつかないようミップマップを使う
+    sea_texture_ = CookedTexture::load(params_.getValueForKey<std::string>("sea.wave_texture"),
+                                       ci::gl::Texture2d::Format()
+                                       .wrap(GL_REPEAT)
+                                       .mipmap()
+                                       .minFilter(GL_LINEAR_MIPMAP_LINEAR));
     sea_mesh_ = ci::gl::VboMesh::create(mesh);
   }
   
    
-  void checkContainsStage(const int x, const int z,
-                          bool checked[][7],
-                          std::vector<ci::ivec2>& disp_stages,
-                          const ci::ivec2& center,
-                          const ci::Frustum& frustum) {
-    // すでにチェック済み
-    if (checked[x + 3][z + 3]) return;
-    checked[x + 3][z + 3] = true;
-
-    // 判定用のAABBを取得
-    ci::ivec2 stage_pos(x + center.x, z + center.y);
-    const auto& s = stage.getStage(stage_pos);
-    const auto& b = s.getAABB();
-
-    // TIPS:海面の描画を含む
-    ci::vec3 min_pos = b.getMin();
-    ci::vec3 max_pos = b.getMax();
-    max_pos.y = std::max(max_pos.y, sea_level_);
-    
-    ci::vec3 pos((x + center.x) * BLOCK_SIZE, 0, (z + center.y) * BLOCK_SIZE);
-    ci::AxisAlignedBox aabb(min_pos + pos, max_pos + pos);
-    if (!frustum.intersects(aabb)) return;
-    
-    disp_stages.push_back(stage_pos);
-    
-    // 再帰で周囲の地形もチェック
-    if (x > -3) checkContainsStage(x - 1,     z, checked, disp_stages, center, frustum);
-    if (x <  3) checkContainsStage(x + 1,     z, checked, disp_stages, center, frustum);
-    if (z > -3) checkContainsStage(    x, z - 1, checked, disp_stages, center, frustum);
-    if (z <  3) checkContainsStage(    x, z + 1, checked, disp_stages, center, frustum);
-  }
-  
-  
-  // カメラから見える地形を選出
-  std::vector<ci::ivec2> checkContainsStage(const ci::ivec2& center,
-                                            const ci::Frustum& frustum) {
-    // TIPS:再帰を利用して周囲のブロックの可視判定
-    std::vector<ci::ivec2> disp_stages;
-    bool checked[7][7] = {};
-    checkContainsStage(0, 0, checked, disp_stages, center, frustum);
-
-    return disp_stages;
-  }
-
-  
   void pickStage(const ci::vec2& pos) {
     picked_ = false;
 
@@ -297,31 +308,22 @@ class Game {
     // TIPS:誤差があると経路検索で目的地にたどり着かないw
     sea_pos.y = sea_level_;
 
-    // どの区画をクリックしたか判定
-    float click_z;
-    if (!ray.calcPlaneIntersection(ci::vec3(0, 0, 0), ci::vec3(0, 1, 0), &click_z)) return;
-    ci::vec3 p = ray.calcPosition(click_z);
-
     float cross_min_z = std::numeric_limits<float>::max();
-    ci::ivec2 center_pos(glm::floor(p.x / BLOCK_SIZE), glm::floor(p.z / BLOCK_SIZE));
-    ci::Frustum frustum(camera);
-    auto draw_stages = checkContainsStage(center_pos, frustum);
 
-    DOUT << "draw_stages:" << draw_stages.size() << std::endl;
-    
-    for (const auto& stage_pos : draw_stages) {
+    // TIPS:クリック判定は描画と同じ可視判定の結果を使う
+    for (const auto& visible : visible_set_.getStages()) {
       // Rayを平行移動
       ci::Ray t_ray = ray;
-      t_ray.setOrigin(ray.getOrigin() + ci::vec3(stage_pos.x * -BLOCK_SIZE, 0, stage_pos.y * -BLOCK_SIZE));
+      t_ray.setOrigin(ray.getOrigin() - visible.offset);
           
-      const auto& s = stage.getStage(stage_pos);
+      const auto& s = *visible.stage;
 
       float cross_z[2];
       if (!s.getAABB().intersect(t_ray, &cross_z[0], &cross_z[1])) continue;
       if (cross_z[0] >= cross_min_z) continue;
           
-      // TriMeshを調べて交差点を特定する
-      auto result = intersect(t_ray, s.getLandMesh());
+      // 三角形を調べて交差点を特定する
+      auto result = RayTriangle::intersect(t_ray, s.getTriangles());
       if (result.first && result.second < cross_min_z) {
         picked_ = true;
 
@@ -330,18 +332,17 @@ class Game {
         picked_pos_ = ray.calcPosition(result.second);
 
         // AABBも保持
-        ci::mat4 m = glm::translate(ci::mat4(1.0), ci::vec3(stage_pos.x * BLOCK_SIZE, 0, stage_pos.y * BLOCK_SIZE));
-        picked_aabb_ = s.getAABB().transformed(m);
+        picked_aabb_ = s.getAABB().transformed(visible.transform);
       }
 
       // 遺物を直接クリックしてるか調べる
-      auto relic_cross = intersect(t_ray, stage.getRelics(stage_pos), sea_level_);
+      auto relic_cross = intersect(t_ray, *visible.relics, sea_level_);
       if (std::get<0>(relic_cross) && (std::get<1>(relic_cross) < cross_min_z)) {
         picked_ = true;
         cross_min_z = std::get<1>(relic_cross);
 
         ci::vec3 p(std::get<2>(relic_cross)); 
-        picked_pos_ = p + ci::vec3(stage_pos.x * BLOCK_SIZE + 0.5, 0, stage_pos.y * BLOCK_SIZE + 0.5);
+        picked_pos_ = p + visible.offset + ci::vec3(0.5, 0, 0.5);
 
         DOUT << "picked relics " << picked_pos_ << std::endl;
       }
@@ -373,6 +374,7 @@ class Game {
       search_pos_ = waypoint.pos;
 
       ship_.setRoute(route);
+      route_drawer_.setRoute(route);
       route_start_time_ = duration;
       route_end_time_   = waypoint.duration;
       ship_.start();
@@ -473,7 +475,7 @@ class Game {
   void foundItem() {
     // イベント送信
     int index = random_item_();
-    const auto& item = params_["item.body"][index].getValueForKey<std::string>("name");
+    const auto& item = items_[index].name;
     bool new_item    = found_items_.count(item) ? false : true;
 
     found_items_.insert(item);
@@ -542,38 +544,144 @@ class Game {
 
     
   // 陸地の描画
-  void drawStage(const std::vector<ci::ivec2>& draw_stages) {
-    ci::gl::ScopedGlslProg shader(stage_drawer_.getShader());
-
-    for (const auto& stage_pos : draw_stages) {
-      ci::vec3 pos(ci::vec3(stage_pos.x * BLOCK_SIZE, 0, stage_pos.y * BLOCK_SIZE));
-
-      ci::mat4 transform = glm::translate(pos);
-      ci::gl::setModelMatrix(transform);
-      
-      const auto& s = stage.getStage(stage_pos);
+  void drawStage(RenderQueue& queue) {
+    const auto& frustum = visible_set_.getFrustum();
+    for (const auto& visible : visible_set_.getStages()) {
+      const auto& s = *visible.stage;
       if (disp_stage_) {
-        stage_drawer_.draw(stage_pos, s);
+        stage_drawer_.draw(queue, light_, visible.pos, s, visible.offset, visible.transform, frustum);
       }
       if (disp_stage_obj_) {
-        stageobj_drawer_.draw(stage_pos, s);
+        stageobj_drawer_.draw(queue, light_, visible.pos, s, visible.transform);
       }
     }
   }
 
-  void drawRelics(const std::vector<ci::ivec2>& draw_stages) {
-    const ci::vec3 center = ship_.getPosition();
-    
-    for (const auto& stage_pos : draw_stages) {
-      ci::vec3 pos(ci::vec3(stage_pos.x * BLOCK_SIZE, 0, stage_pos.y * BLOCK_SIZE));
+  // 描画命令を積む
+  //   FBOと画面の両方で同じ命令を使う
+  void submitDraws() {
+    scene_queue_.clear();
+    drawStage(scene_queue_);
+    relic_drawer_.draw(scene_queue_, ui_light_, sea_level_);
+    ship_.draw(scene_queue_, light_);
 
-      relic_drawer_.draw(stage.getRelics(stage_pos), pos, center - pos, sea_level_);
+    overlay_queue_.clear();
+    target_.draw(overlay_queue_, ui_light_);
+    if (has_route_) {
+      // 経路表示
+      route_drawer_.draw(overlay_queue_, ui_light_, sea_level_);
     }
   }
 
-  // 経路表示
-  void drawRoute() {
-    route_drawer_.draw(ship_.getRoute(), ui_light_, sea_level_);
+  // 海面に映り込む景色
+  void drawScene() {
+    render_stats_ += scene_queue_.execute(render_backend_);
+  }
+
+  // 描画命令の実行状況を出力
+  void dumpRenderQueue() {
+    RecordingBackend backend;
+    scene_queue_.execute(backend);
+    overlay_queue_.execute(backend);
+
+    DOUT << "render queue:"
+         << " commands " << (scene_queue_.size() + overlay_queue_.size())
+         << " shader " << backend.count(RecordingBackend::Op::BIND_SHADER)
+         << " texture " << backend.count(RecordingBackend::Op::BIND_TEXTURE)
+         << " light " << backend.count(RecordingBackend::Op::SETUP_LIGHT)
+         << " transform " << backend.count(RecordingBackend::Op::SET_TRANSFORM)
+         << " offset " << backend.count(RecordingBackend::Op::SET_OFFSET)
+         << " draw " << backend.count(RecordingBackend::Op::DRAW)
+         << std::endl;
+  }
+
+  // 海面の描画
+  //   texture 海面越しに見える景色
+  void drawSea(const ci::gl::Texture2dRef& texture) {
+    ci::gl::ScopedGlslProg shader(sea_shader_);
+    ci::gl::ScopedTextureBind fbo_texture(texture, 0);
+    ci::gl::ScopedTextureBind sea_texture(sea_texture_, 1);
+        
+    sea_shader_->uniform("offset", sea_offset_);
+    sea_shader_->uniform("wave", sea_wave_);
+    sea_shader_->uniform("color", sea_color_);
+    auto vp = ci::gl::getViewport();
+    sea_shader_->uniform("window_size", ci::vec2(vp.second));
+
+    for (const auto& visible : visible_set_.getStages()) {
+      ci::mat4 transform = glm::translate(visible.offset + ci::vec3(0, sea_level_, 0));
+      ci::gl::setModelMatrix(transform);
+
+      ci::gl::draw(sea_mesh_);
+    }
+  }
+
+  // 景色をFBOと画面に２回描画する
+  void drawTwoPass() {
+    {
+      // 海面演出のためにFBOへ描画
+      const auto& fbo = fbo_governor_.getFbo();
+      ci::gl::ScopedViewport viewportScope(fbo->getSize());
+      ci::gl::ScopedFramebuffer fboScope(fbo);
+      ci::gl::clear(bg_color);
+
+      drawScene();
+    }
+
+    ci::gl::clear(bg_color);
+
+    if (disp_sea_) {
+      // TIPS:まっさらな画面に描画するので
+      //      デプステストは必要ない
+      glDepthFunc(GL_ALWAYS);
+
+      drawSea(fbo_governor_.getFbo()->getColorTexture());
+
+      // デプステストを元に戻す
+      glDepthFunc(GL_LESS);
+    }
+
+    drawScene();
+  }
+
+  // 景色は画面と同じ大きさのFBOへ一度だけ描画し、
+  // 色とデプスを画面へ転送してから海面を重ねる
+  // TIPS:デプスの転送は画面側のデプスバッファと形式が一致している必要がある
+  //      (マルチサンプルの画面では使えない)
+  void drawSinglePass() {
+    auto vp = ci::gl::getViewport();
+    const auto& size = vp.second;
+    if (!scene_fbo_ || (scene_fbo_->getSize() != size)) {
+      auto format = ci::gl::Fbo::Format()
+        .colorTexture()
+        .depthBuffer(GL_DEPTH_COMPONENT24)
+        ;
+      scene_fbo_ = ci::gl::Fbo::create(size.x, size.y, format);
+    }
+
+    {
+      ci::gl::ScopedFramebuffer fboScope(scene_fbo_);
+      ci::gl::ScopedViewport viewportScope(size);
+      ci::gl::clear(bg_color);
+
+      drawScene();
+    }
+
+    {
+      ci::gl::ScopedFramebuffer fboScope(scene_fbo_, GL_READ_FRAMEBUFFER);
+      glBlitFramebuffer(0, 0, size.x, size.y,
+                        vp.first.x, vp.first.y, vp.first.x + size.x, vp.first.y + size.y,
+                        GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+
+    if (disp_sea_) {
+      // TIPS:２パスの時と同じく、同じ深度なら海面を優先する
+      glDepthFunc(GL_LEQUAL);
+
+      drawSea(scene_fbo_->getColorTexture());
+
+      glDepthFunc(GL_LESS);
+    }
   }
 
 
@@ -758,6 +866,7 @@ class Game {
       route_start_time_ = record.getValueForKey<double>("route_start_time");
       route_end_time_   = record.getValueForKey<double>("route_end_time");
 
+      route_drawer_.setRoute(ship_route);
       ship_.setRoute(ship_route);
       ship_.start();
 
@@ -809,18 +918,82 @@ class Game {
   }
 
 
+  // 交差判定の検証
+  //   見えている地形へランダムなRayを飛ばし、ci::Rayでの判定結果と比べる
+  void validateRayTriangle() {
+    enum { RAY_NUM = 200 };
+
+    int hit_num      = 0;
+    int mismatch_num = 0;
+    double elapsed[3] = {};
+
+    for (const auto& visible : visible_set_.getStages()) {
+      const auto& s = *visible.stage;
+      const auto& triangles = s.getTriangles();
+      
+      for (int i = 0; i < RAY_NUM; ++i) {
+        ci::vec3 origin(ci::randFloat(0, BLOCK_SIZE), ci::randFloat(20, 40), ci::randFloat(0, BLOCK_SIZE));
+        ci::vec3 direction(ci::randFloat(-1, 1), ci::randFloat(-1, -0.1), ci::randFloat(-1, 1));
+        ci::Ray ray(origin, glm::normalize(direction));
+
+        ci::Timer timer(true);
+        auto expected = intersect(ray, s.getLandMesh());
+        elapsed[0] += timer.getSeconds();
+
+        timer.start();
+        auto scalar = RayTriangle::intersectScalar(ray, triangles);
+        elapsed[1] += timer.getSeconds();
+
+        timer.start();
+        auto simd = RayTriangle::intersectSimd(ray, triangles);
+        elapsed[2] += timer.getSeconds();
+
+        if (expected.first) hit_num += 1;
+
+        for (const auto& result : { scalar, simd }) {
+          if ((result.first != expected.first)
+              || (expected.first && std::abs(result.second - expected.second) > 0.0001f)) {
+            mismatch_num += 1;
+          }
+        }
+      }
+    }
+
+    DOUT << "ray-triangle: stages:" << visible_set_.getStages().size()
+         << " hit:" << hit_num
+         << " mismatch:" << mismatch_num
+         << " simd:" << RayTriangle::hasSimd()
+         << std::endl
+         << " ci::Ray:" << elapsed[0]
+         << " scalar:" << elapsed[1]
+         << " simd:" << elapsed[2]
+         << std::endl;
+  }
+  
+
   void setupDebugEvent() {
     holder_ += event_.connect("debug_item_reporter",
                               [this](const Arguments&) {
                                 foundItem();                                
                               });
+
+    holder_ += event_.connect("debug_ray_triangle",
+                              [this](const Arguments&) {
+                                validateRayTriangle();
+                              });
+
+    holder_ += event_.connect("debug_render_queue",
+                              [this](const Arguments&) {
+                                dumpRenderQueue();
+                              });
   }
 
   
 public:
-  Game(Event& event, const ci::JsonTree& params)
+  Game(Event& event, const Params& params)
     : event_(event),
-      params_(params),
+      params_(params.json),
+      items_(params.items),
       fov(params_.getValueForKey<float>("camera.fov")),
       near_z(params_.getValueForKey<float>("camera.near_z")),
       far_z(params_.getValueForKey<float>("camera.far_z")),
@@ -845,8 +1018,32 @@ public:
       sea_color_(Json::getColorA<float>(params_["sea.color"])),
       sea_speed_(Json::getVec<ci::vec2>(params_["sea.speed"])),
       sea_wave_(params_.getValueForKey<float>("sea.wave")),
+      fbo_governor_(params_["fbo"]),
+      frame_time_(0.0f),
+      single_pass_(params_.getValueForKey<bool>("render.single_pass")),
+      stage_drawer_(params_["stage_draw"]),
+      stageobj_drawer_(params_["stage_obj"]),
       relic_drawer_(params_["relic"]),
       route_drawer_(params_["route"]),
+      visible_stage_num_(0),
+      culled_stage_num_(0),
+      generated_stage_num_(0),
+      last_generated_num_(0),
+      stage_triangle_num_(0),
+      coarse_stage_num_(0),
+      stage_obj_num_(0),
+      upload_kbytes_(0.0f),
+      upload_time_(0.0f),
+      pending_upload_kbytes_(0.0f),
+      arena_kbytes_(0.0f),
+      arena_capacity_kbytes_(0.0f),
+      arena_fragment_num_(0),
+      arena_rebuild_num_(0),
+      draw_call_num_(0),
+      state_change_num_(0),
+      draw_cpu_time_(0.0f),
+      ui_vertex_num_(0),
+      ui_draw_num_(0),
       picked_(false),
       ship_(event_, params_["ship"]),
       ship_camera_(event_, params_),
@@ -860,7 +1057,8 @@ public:
       day_lighting_(params_["day_lighting"]),
       ui_light_(createLight(params_["ui_light"])),
       ui_shader_(createShader("ui", "ui")),
-      random_item_(createItemProbabilities(params_)),
+      ui_drawer_(params_["ui_draw"], ui_shader_),
+      random_item_(createItemProbabilities(items_)),
       disp_stage_(true),
       disp_stage_obj_(true),
       disp_sea_(true),
@@ -894,12 +1092,6 @@ public:
     bg_color = ci::Color(0, 0, 0);
 
     createSeaMesh();
-    
-    // FBO
-    auto format = ci::gl::Fbo::Format()
-      .colorTexture()
-      ;
-    fbo_ = ci::gl::Fbo::create(FBO_WIDTH, FBO_HEIGHT, format);
 
     registerCallbacks();
 
@@ -910,7 +1102,10 @@ public:
     }
     
     // 記録ファイルがあるなら読み込む
-    restoreFromRecords();
+    {
+      ScopedTiming timing("restoreFromRecords");
+      restoreFromRecords();
+    }
 
     setupDebugEvent();
   }
@@ -1016,6 +1211,10 @@ public:
     // アプリ開始時からの経過時間
     duration_ = current_time - start_time_;
 
+    fbo_governor_.update(ci::app::getElapsedSeconds(), ci::app::toPixels(ci::app::getWindowSize()));
+    fbo_size_   = fbo_governor_.getSize();
+    frame_time_ = fbo_governor_.getFrameTime() * 1000.0;
+
     // 探索
     if (searching_) {
       progressSearch(duration_);
@@ -1057,88 +1256,77 @@ public:
     ship_.update(duration_, sea_level_);
     target_.update(duration_, sea_level_);
 
-    relic_drawer_.update();
+    // 時々データを整理
+    // TIPS:見えている地形を参照し直す前に行う
+    {
+      // とりあえず1分に一回程度
+      if ((ci::app::getElapsedFrames() % (60 * 60)) == 0) {
+        DOUT << "Garbage Collection" << std::endl;
+        const auto& pos = visible_set_.getCenter();
+        stage.garbageCollection(pos, ci::ivec2(5, 5));
+        stage_drawer_.garbageCollection(pos, ci::ivec2(5, 5));
+        stageobj_drawer_.garbageCollection(pos, ci::ivec2(5, 5));
+      }
+    }
+
+    // 見えている地形はこのフレームの描画とクリック判定で使い回す
+    visible_set_.update(camera, stage, sea_level_);
+    visible_stage_num_ = visible_set_.getStages().size();
+    culled_stage_num_  = visible_set_.getCulledNum();
+
+    stage_drawer_.update(visible_set_.getStages());
+    relic_drawer_.update(visible_set_.getStages(), ship_.getPosition());
+
+    const auto& upload_stats = stage_drawer_.getUploadStats();
+    upload_kbytes_         = upload_stats.uploaded_bytes / 1024.0f;
+    upload_time_           = upload_stats.upload_time * 1000.0;
+    pending_upload_kbytes_ = upload_stats.pending_bytes / 1024.0f;
+
+    auto arena_stats = stage_drawer_.getArenaStats();
+    arena_kbytes_          = (arena_stats.vertex_used * sizeof(GeometryArena::Vertex)
+                              + arena_stats.index_used * sizeof(uint32_t)) / 1024.0f;
+    arena_capacity_kbytes_ = (arena_stats.vertex_capacity * sizeof(GeometryArena::Vertex)
+                              + arena_stats.index_capacity * sizeof(uint32_t)) / 1024.0f;
+    arena_fragment_num_    = arena_stats.fragment_num;
+    arena_rebuild_num_     = arena_stats.rebuild_num;
+  }
+
+  // 一度updateして、景色を描画できる状態か
+  bool isReady() const {
+    return visible_set_.isValid();
   }
   
   void draw() {
+    ci::Timer timer(true);
+
     ci::gl::setMatrices(camera);
+
+    // カメラと光源はフレームの最初に一度だけ更新する
+    auto& uniforms = getSharedUniforms();
+    uniforms.setCamera(&camera, camera);
+    uniforms.setLight(light_);
+    uniforms.setLight(ui_light_);
+    uniforms.bindCamera(&camera);
+
     ci::gl::disableAlphaBlending();
     ci::gl::enableDepth(true);
     ci::gl::enable(GL_CULL_FACE);
 
-    stage_drawer_.setupLight(light_);
-    relic_drawer_.setupLight(ui_light_);
+    render_stats_ = RenderStats();
     
-    // 陸地の描画
-    // 画面中央の座標をレイキャストして求めている
-    ci::Ray ray = camera.generateRay(0.5f, 0.5f,
-                                     camera.getAspectRatio());
-    
-    float z;
-    if (ray.calcPlaneIntersection(ci::vec3(0, 0, 0), ci::vec3(0, 1, 0), &z)) {
-      ci::vec3 p = ray.calcPosition(z);
-
-      // 中央ブロックの座標
-      ci::ivec2 pos(glm::floor(p.x / BLOCK_SIZE), glm::floor(p.z / BLOCK_SIZE));
-
-      // 時々データを整理
-      {
-        // とりあえず1分に一回程度
-        if ((ci::app::getElapsedFrames() % (60 * 60)) == 0) {
-          DOUT << "Garbage Collection" << std::endl;
-          stage.garbageCollection(pos, ci::ivec2(5, 5));
-          stage_drawer_.garbageCollection(pos, ci::ivec2(5, 5));
-        }
-      }
+    if (visible_set_.isValid()) {
+      stage_drawer_.resetTriangleNum();
+      stageobj_drawer_.resetInstanceNum();
+      submitDraws();
 
-      ci::Frustum frustum(camera);
-      auto draw_stages = checkContainsStage(pos, frustum);
-
-      {
-        // 海面演出のためにFBOへ描画
-        ci::gl::ScopedViewport viewportScope(fbo_->getSize());
-        ci::gl::ScopedFramebuffer fboScope(fbo_);
-        ci::gl::clear(bg_color);
-
-        drawStage(draw_stages);
-        drawRelics(draw_stages);
-        ship_.draw(light_);
+      if (single_pass_) {
+        drawSinglePass();
       }
-
-      ci::gl::clear(bg_color);
-
-      // 海面の描画
-      if (disp_sea_) {
-        ci::gl::ScopedGlslProg shader(sea_shader_);
-        ci::gl::ScopedTextureBind fbo_texture(fbo_->getColorTexture(), 0);
-        ci::gl::ScopedTextureBind sea_texture(sea_texture_, 1);
-        
-        sea_shader_->uniform("offset", sea_offset_);
-        sea_shader_->uniform("wave", sea_wave_);
-        sea_shader_->uniform("color", sea_color_);
-        auto vp = ci::gl::getViewport();
-        sea_shader_->uniform("window_size", ci::vec2(vp.second));
-
-        // TIPS:まっさらな画面に描画するので
-        //      デプステストは必要ない
-        glDepthFunc(GL_ALWAYS);
-
-        for (const auto& stage_pos : draw_stages) {
-          ci::vec3 pos(ci::vec3(stage_pos.x * BLOCK_SIZE, sea_level_, stage_pos.y * BLOCK_SIZE));
-          ci::mat4 transform = glm::translate(pos);
-          ci::gl::setModelMatrix(transform);
-
-          ci::gl::draw(sea_mesh_);
-        }
-
-        // デプステストを元に戻す
-        glDepthFunc(GL_LESS);
+      else {
+        drawTwoPass();
       }
-      
-      drawStage(draw_stages);
-      drawRelics(draw_stages);
-      ship_.draw(light_);
-      target_.draw(ui_light_);
+
+      render_stats_ += overlay_queue_.execute(render_backend_);
       
 #if 0
       if (picked_) {
@@ -1149,12 +1337,17 @@ public:
         ci::gl::drawSphere(picked_pos_, 0.1f);
       }
 #endif
-
-      if (has_route_) {
-        drawRoute();
-      }
     }
 
+    // このフレームで生成した地形の数
+    generated_stage_num_ = stage.getGeneratedNum() - last_generated_num_;
+    last_generated_num_  = stage.getGeneratedNum();
+    stage_triangle_num_  = stage_drawer_.getTriangleNum();
+    coarse_stage_num_    = stage_drawer_.getCoarseNum();
+    stage_obj_num_       = stageobj_drawer_.getInstanceNum();
+    draw_call_num_       = render_stats_.draw_num;
+    state_change_num_    = render_stats_.getStateChangeNum();
+
     // UI
     ci::gl::setMatrices(ui_camera_);
     ci::gl::enableDepth(false);
@@ -1170,15 +1363,21 @@ public:
         float t = (route_end_time_ - duration_) / (route_end_time_ - route_start_time_);
         
         ci::vec3 pos = UI::getScreenPosition(ship_.getPosition() + ci::vec3(0.5, 1.5, 0.5), camera, ui_camera_);
-        pie_chart_.draw(ci::vec2(pos.x, pos.y), 0.0024f, t, ci::Color(0, 1, 0));
+        pie_chart_.draw(ui_drawer_, ci::vec2(pos.x, pos.y), 0.0024f, t, ci::Color(0, 1, 0));
       }
       else if (searching_) {
         float t = (search_end_time_ - duration_) / (search_end_time_ - search_start_time_);
         
         ci::vec3 pos = UI::getScreenPosition(ship_.getPosition() + ci::vec3(0.5, 1.5, 0.5), camera, ui_camera_);
-        pie_chart_.draw(ci::vec2(pos.x, pos.y), 0.0024f, t, ci::Color(0, 0, 1));
+        pie_chart_.draw(ui_drawer_, ci::vec2(pos.x, pos.y), 0.0024f, t, ci::Color(0, 0, 1));
       }
+
+      ui_drawer_.flush();
     }
+    ui_vertex_num_ = int(ui_drawer_.getStats().vertex_num);
+    ui_draw_num_   = ui_drawer_.getStats().draw_num;
+
+    draw_cpu_time_ = timer.getSeconds() * 1000.0;
   }
 
   void debugDraw() {
@@ -1258,6 +1457,32 @@ public:
 
     params->addSeparator();
 
+    params->addParam("Visible Stage",   &visible_stage_num_,   true);
+    params->addParam("Culled Stage",    &culled_stage_num_,    true);
+    params->addParam("Generated Stage", &generated_stage_num_, true);
+    params->addParam("Stage Triangles", &stage_triangle_num_,  true);
+    params->addParam("Coarse Stage",    &coarse_stage_num_,    true);
+    params->addParam("Stage Objects",   &stage_obj_num_,       true);
+    params->addParam("Upload KB",       &upload_kbytes_,       true);
+    params->addParam("Upload ms",       &upload_time_,         true);
+    params->addParam("Pending KB",      &pending_upload_kbytes_, true);
+    params->addParam("Arena KB",        &arena_kbytes_,          true);
+    params->addParam("Arena Capacity KB", &arena_capacity_kbytes_, true);
+    params->addParam("Arena Fragments", &arena_fragment_num_,    true);
+    params->addParam("Arena Rebuilds",  &arena_rebuild_num_,     true);
+    params->addParam("SIMD Ray",        &RayTriangle::useSimd());
+    params->addParam("Draw Calls",      &draw_call_num_,       true);
+    params->addParam("State Changes",   &state_change_num_,    true);
+    params->addParam("Single Pass",     &single_pass_);
+    params->addParam("Frame ms",        &frame_time_,          true);
+    params->addParam("FBO Width",       &fbo_size_.x,          true);
+    params->addParam("FBO Height",      &fbo_size_.y,          true);
+    params->addParam("Draw CPU ms",     &draw_cpu_time_,       true);
+    params->addParam("UI Vertices",     &ui_vertex_num_,       true);
+    params->addParam("UI Draws",        &ui_draw_num_,         true);
+
+    params->addSeparator();
+
     light_direction_.x = light_.direction.x;
     light_direction_.y = light_.direction.y;
     light_direction_.z = light_.direction.z;
@@ -0,0 +1,357 @@
+﻿#pragma once
+
+//
+// 地形メッシュをまとめて格納する頂点・インデックスバッファ
+//   全ての地形が一つのVAOを共有するので、描画ごとのバインドが要らない
+//   インデックスは格納位置に合わせて書き換えてあるので、
+//   glDrawElementsだけで描画できる(ES3にはBaseVertex付きの描画命令が無い)
+//
+
+#include <cinder/gl/Batch.h>
+#include <cinder/gl/Vbo.h>
+#include <cinder/gl/VboMesh.h>
+#include <cinder/gl/scoped.h>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+#include "UploadQueue.hpp"
+
+
+namespace ngs {
+
+// 領域の割り当て
+//   空き領域の先頭から順に探し、解放時は隣り合った空き領域を結合する
+class RangeAllocator {
+  // 空き領域(先頭位置 -> 大きさ)
+  std::map<size_t, size_t> free_;
+  size_t capacity_;
+
+
+public:
+  explicit RangeAllocator(const size_t capacity) {
+    reset(capacity, 0);
+  }
+
+
+  // 先頭から used まで使用中にする
+  void reset(const size_t capacity, const size_t used) {
+    capacity_ = capacity;
+    free_.clear();
+    if (used < capacity) {
+      free_.insert(std::make_pair(used, capacity - used));
+    }
+  }
+
+  bool allocate(const size_t size, size_t& offset) {
+    for (auto it = std::begin(free_); it != std::end(free_); ++it) {
+      if (it->second < size) continue;
+
+      offset = it->first;
+      size_t rest = it->second - size;
+      free_.erase(it);
+      if (rest > 0) {
+        free_.insert(std::make_pair(offset + size, rest));
+      }
+      return true;
+    }
+
+    return false;
+  }
+
+  void release(const size_t offset, size_t size) {
+    if (size == 0) return;
+
+    size_t start = offset;
+
+    // 後ろの空き領域と結合
+    auto next = free_.lower_bound(offset);
+    if (next != std::end(free_) && next->first == (offset + size)) {
+      size += next->second;
+      next = free_.erase(next);
+    }
+
+    // 前の空き領域と結合
+    if (next != std::begin(free_)) {
+      auto prev = std::prev(next);
+      if ((prev->first + prev->second) == offset) {
+        start = prev->first;
+        size += prev->second;
+        free_.erase(prev);
+      }
+    }
+
+    free_.insert(std::make_pair(start, size));
+  }
+
+
+  size_t getCapacity() const {
+    return capacity_;
+  }
+
+  size_t getFreeSize() const {
+    size_t size = 0;
+    for (const auto& f : free_) {
+      size += f.second;
+    }
+    return size;
+  }
+
+  // 空き領域の数(断片化の目安)
+  size_t getFragmentNum() const {
+    return free_.size();
+  }
+
+};
+
+
+class GeometryArena {
+public:
+  struct Vertex {
+    ci::vec3 position;
+    ci::vec3 normal;
+    ci::vec2 tex_coord;
+  };
+
+  // 格納されたメッシュ
+  //   TIPS:手放すと次の割り当て時に領域が解放される
+  struct Allocation {
+    size_t vertex_offset;
+    size_t vertex_num;
+    size_t index_offset;
+    size_t index_num;
+
+    UploadQueue::TicketRef ticket;
+
+    bool isResident() const {
+      return ticket->isDone();
+    }
+  };
+
+  using AllocationRef = std::shared_ptr<Allocation>;
+
+  struct Stats {
+    size_t vertex_capacity = 0;
+    size_t vertex_used     = 0;
+    size_t index_capacity  = 0;
+    size_t index_used      = 0;
+    size_t fragment_num    = 0;
+    int rebuild_num        = 0;
+  };
+
+
+private:
+  struct Record {
+    std::weak_ptr<Allocation> owner;
+
+    // 詰め直す時に使う
+    std::vector<uint32_t> indices;
+    size_t vertex_offset;
+    size_t vertex_num;
+    size_t index_offset;
+  };
+
+  UploadQueue& upload_queue_;
+  ci::gl::GlslProgRef shader_;
+
+  RangeAllocator vertices_;
+  RangeAllocator indices_;
+
+  ci::gl::VboRef vbo_;
+  ci::gl::VboRef ibo_;
+  ci::gl::BatchRef batch_;
+
+  std::vector<Record> records_;
+
+  int rebuild_num_ = 0;
+
+
+  void createBuffers() {
+    vbo_ = ci::gl::Vbo::create(GL_ARRAY_BUFFER,
+                               vertices_.getCapacity() * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+    ibo_ = ci::gl::Vbo::create(GL_ELEMENT_ARRAY_BUFFER,
+                               indices_.getCapacity() * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+
+    ci::geom::BufferLayout layout;
+    layout.append(ci::geom::Attrib::POSITION,    3, sizeof(Vertex), offsetof(Vertex, position));
+    layout.append(ci::geom::Attrib::NORMAL,      3, sizeof(Vertex), offsetof(Vertex, normal));
+    layout.append(ci::geom::Attrib::TEX_COORD_0, 2, sizeof(Vertex), offsetof(Vertex, tex_coord));
+
+    auto mesh = ci::gl::VboMesh::create(vertices_.getCapacity(), GL_TRIANGLES, { { layout, vbo_ } },
+                                        indices_.getCapacity(), GL_UNSIGNED_INT, ibo_);
+    batch_ = ci::gl::Batch::create(mesh, shader_);
+  }
+
+  // 手放されたメッシュの領域を解放
+  void collect() {
+    for (auto it = std::begin(records_); it != std::end(records_); ) {
+      if (it->owner.expired()) {
+        vertices_.release(it->vertex_offset, it->vertex_num);
+        indices_.release(it->index_offset, it->indices.size());
+        it = records_.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+  static std::vector<uint8_t> rebaseIndices(const std::vector<uint32_t>& indices, const size_t vertex_offset) {
+    std::vector<uint8_t> data(indices.size() * sizeof(uint32_t));
+    auto* p = reinterpret_cast<uint32_t*>(&data[0]);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      p[i] = uint32_t(indices[i] + vertex_offset);
+    }
+    return data;
+  }
+
+  // 使用中のメッシュを新しいバッファの先頭から詰め直す
+  //   頂点はGPU上でコピーし、インデックスは位置が変わるので書き直す
+  void rebuild(const size_t vertex_capacity, const size_t index_capacity) {
+    // TIPS:転送中のデータが古いバッファに書き込まれないよう先に済ませる
+    upload_queue_.flush();
+
+    auto old_vbo = vbo_;
+
+    vertices_.reset(vertex_capacity, 0);
+    indices_.reset(index_capacity, 0);
+    createBuffers();
+
+    std::vector<uint8_t> index_data;
+
+    size_t vertex_offset = 0;
+    size_t index_offset  = 0;
+    {
+      ci::gl::ScopedBuffer read_buffer(GL_COPY_READ_BUFFER, old_vbo->getId());
+      ci::gl::ScopedBuffer write_buffer(GL_COPY_WRITE_BUFFER, vbo_->getId());
+
+      for (auto& record : records_) {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                            record.vertex_offset * sizeof(Vertex), vertex_offset * sizeof(Vertex),
+                            record.vertex_num * sizeof(Vertex));
+
+        auto data = rebaseIndices(record.indices, vertex_offset);
+        index_data.insert(std::end(index_data), std::begin(data), std::end(data));
+
+        record.vertex_offset = vertex_offset;
+        record.index_offset  = index_offset;
+
+        if (auto owner = record.owner.lock()) {
+          owner->vertex_offset = vertex_offset;
+          owner->index_offset  = index_offset;
+        }
+
+        vertex_offset += record.vertex_num;
+        index_offset  += record.indices.size();
+      }
+    }
+
+    if (!index_data.empty()) {
+      ibo_->bufferSubData(0, index_data.size(), &index_data[0]);
+    }
+
+    vertices_.reset(vertex_capacity, vertex_offset);
+    indices_.reset(index_capacity, index_offset);
+
+    rebuild_num_ += 1;
+  }
+
+  // 領域を確保する
+  //   断片化していれば詰め直し、それでも足りなければ拡張する
+  bool reserve(const size_t vertex_num, const size_t index_num,
+               size_t& vertex_offset, size_t& index_offset) {
+    for (int retry = 0; retry < 3; ++retry) {
+      size_t v, i;
+      if (vertices_.allocate(vertex_num, v)) {
+        if (indices_.allocate(index_num, i)) {
+          vertex_offset = v;
+          index_offset  = i;
+          return true;
+        }
+        vertices_.release(v, vertex_num);
+      }
+
+      size_t vertex_capacity = vertices_.getCapacity();
+      size_t index_capacity  = indices_.getCapacity();
+      size_t vertex_used = vertex_capacity - vertices_.getFreeSize();
+      size_t index_used  = index_capacity  - indices_.getFreeSize();
+
+      // 詰め直しても入らない場合は倍々で拡張
+      while ((vertex_used + vertex_num) > vertex_capacity) vertex_capacity *= 2;
+      while ((index_used  + index_num)  > index_capacity)  index_capacity  *= 2;
+
+      rebuild(vertex_capacity, index_capacity);
+    }
+
+    return false;
+  }
+
+
+public:
+  GeometryArena(UploadQueue& upload_queue, const ci::gl::GlslProgRef& shader,
+                const size_t vertex_capacity, const size_t index_capacity)
+    : upload_queue_(upload_queue),
+      shader_(shader),
+      vertices_(std::max(vertex_capacity, size_t(1))),
+      indices_(std::max(index_capacity, size_t(1)))
+  {
+    createBuffers();
+  }
+
+
+  // メッシュを格納し、転送を予約する
+  AllocationRef allocate(const std::vector<Vertex>& vertices, std::vector<uint32_t> indices) {
+    if (vertices.empty() || indices.empty()) return AllocationRef();
+
+    collect();
+
+    size_t vertex_offset;
+    size_t index_offset;
+    if (!reserve(vertices.size(), indices.size(), vertex_offset, index_offset)) return AllocationRef();
+
+    auto allocation = std::make_shared<Allocation>();
+    allocation->vertex_offset = vertex_offset;
+    allocation->vertex_num    = vertices.size();
+    allocation->index_offset  = index_offset;
+    allocation->index_num     = indices.size();
+    allocation->ticket        = upload_queue_.createTicket();
+
+    std::vector<uint8_t> vertex_data(vertices.size() * sizeof(Vertex));
+    std::memcpy(&vertex_data[0], &vertices[0], vertex_data.size());
+
+    upload_queue_.push(allocation->ticket, vbo_, vertex_offset * sizeof(Vertex), std::move(vertex_data));
+    upload_queue_.push(allocation->ticket, ibo_, index_offset * sizeof(uint32_t), rebaseIndices(indices, vertex_offset));
+
+    Record record = {
+      allocation,
+      std::move(indices),
+      vertex_offset,
+      vertices.size(),
+      index_offset,
+    };
+    records_.push_back(std::move(record));
+
+    return allocation;
+  }
+
+
+  // 全てのメッシュで共有する
+  const ci::gl::BatchRef& getBatch() const {
+    return batch_;
+  }
+
+  Stats getStats() const {
+    Stats stats;
+    stats.vertex_capacity = vertices_.getCapacity();
+    stats.vertex_used     = stats.vertex_capacity - vertices_.getFreeSize();
+    stats.index_capacity  = indices_.getCapacity();
+    stats.index_used      = stats.index_capacity - indices_.getFreeSize();
+    stats.fragment_num    = vertices_.getFragmentNum() + indices_.getFragmentNum();
+    stats.rebuild_num     = rebuild_num_;
+    return stats;
+  }
+
+};
+
+}
@@ -4,7 +4,7 @@
 // 収集したアイテム
 //
 
-#include "PLY.hpp"
+#include "ItemModel.hpp"
 
 
 namespace ngs {
@@ -19,13 +19,11 @@ class Item {
 public:
   Item() = default;
   
-  Item(const ci::JsonTree& param)
-    : shader_(createShader("color", "color"))
-  {
-    ci::TriMesh mesh(PLY::load(param.getValueForKey<std::string>("file")));
-    aabb_  = mesh.calcBoundingBox();
-    model_ = ci::gl::VboMesh::create(mesh);
-  }
+  Item(const ItemModel::Model& model, const ci::gl::GlslProgRef& shader)
+    : model_(model.mesh),
+      shader_(shader),
+      aabb_(model.aabb)
+  {}
 
   
   const ci::AxisAlignedBox& getAABB() const { return aabb_; }
@@ -34,9 +32,7 @@ public:
   void draw(const Light&light) {
     if (!model_) return;
 
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
+    getSharedUniforms().bindLight(light);
 
     ci::gl::ScopedGlslProg shader(shader_);
     ci::gl::draw(model_);
@@ -0,0 +1,80 @@
+﻿#pragma once
+
+//
+// アイテム発見画面で使うモデル
+//   アイテムと画面のモデルを一度だけ読み込んで保持し、画面を開くたびに読み込まないようにする
+//   起動時に先読みしておき、漏れたものは最初に使う時に読み込む
+//
+
+#include <cinder/gl/GlslProg.h>
+#include <cinder/gl/VboMesh.h>
+#include <map>
+#include "CookedMesh.hpp"
+#include "Params.hpp"
+
+
+namespace ngs {
+
+class ItemModel {
+public:
+  struct Model {
+    ci::gl::VboMeshRef mesh;
+    ci::AxisAlignedBox aabb;
+  };
+
+
+private:
+  std::map<std::string, Model> models_;
+
+  // TIPS:createShaderは弱参照で使い回すので、ここで保持しておかないと画面を閉じるたびに破棄される
+  ci::gl::GlslProgRef color_shader_;
+  ci::gl::GlslProgRef bg_shader_;
+
+
+public:
+  ItemModel()
+    : color_shader_(createShader("color", "color")),
+      bg_shader_(createShader("bg", "bg"))
+  {}
+
+
+  // 読み込むモデルの一覧
+  static std::vector<std::string> getFiles(const Params& params) {
+    std::vector<std::string> files = {
+      "item_reporter.ply",
+      "new.ply",
+      "bg.obj",
+    };
+    for (const auto& item : params.items) {
+      files.push_back(item.file);
+    }
+    return files;
+  }
+
+
+  // 読み込み済みでなければ読み込む
+  const Model& get(const std::string& path) {
+    auto it = models_.find(path);
+    if (it != std::end(models_)) return it->second;
+
+    Model model;
+    model.mesh = CookedMesh::load(path, model.aabb);
+    return models_.insert(std::make_pair(path, model)).first->second;
+  }
+
+  void load(const std::string& path) {
+    get(path);
+  }
+
+
+  const ci::gl::GlslProgRef& getColorShader() const {
+    return color_shader_;
+  }
+
+  const ci::gl::GlslProgRef& getBgShader() const {
+    return bg_shader_;
+  }
+
+};
+
+}
@@ -4,7 +4,6 @@
 // 見つけたアイテムを報告する画面
 //
 
-#include <cinder/ObjLoader.h>
 #include <cinder/Easing.h>
 #include <cinder/Timeline.h>
 #include <cinder/Tween.h>
@@ -16,6 +15,7 @@ namespace ngs {
 
 class ItemReporter {
   Event& event_;
+  ItemModel& item_model_;
   
   // アイテム表示用専用カメラ
   ci::CameraPersp camera_;
@@ -54,9 +54,11 @@ class ItemReporter {
   
 public:
   ItemReporter(Event& event,
+               ItemModel& item_model,
                const ci::JsonTree& params,
                const ci::TimelineRef& timeline)
     : event_(event),
+      item_model_(item_model),
       fov_(params.getValueForKey<float>("camera.fov")),
       near_z_(params.getValueForKey<float>("camera.near_z")),
       light_(createLight(params["light"])),
@@ -81,19 +83,18 @@ public:
     camera_.setEyePoint(Json::getVec<ci::vec3>(params["camera.position"]));
     camera_.setViewDirection(Json::getVec<ci::vec3>(params["camera.direction"]));
 
-    shader_ = createShader("color", "color");
+    shader_ = item_model_.getColorShader();
 
-    ci::TriMesh mesh(PLY::load("item_reporter.ply"));
+    const auto& reporter = item_model_.get("item_reporter.ply");
+    const auto& bb = reporter.aabb;
+    model_[0] = reporter.mesh;
+    model_[1] = item_model_.get("new.ply").mesh;
 
     // 少しオフセットを加えたAABBをクリック判定に使う
     ci::mat4 transform = glm::translate(bg_translate_);
-    auto bb = mesh.calcBoundingBox();
     aabb_ = ci::AxisAlignedBox(bb.getMin(),
                                bb.getMax() + ci::vec3(0, -31, 0)).transformed(transform);
 
-    model_[0] = ci::gl::VboMesh::create(mesh);
-    model_[1] = ci::gl::VboMesh::create(PLY::load("new.ply"));
-
     // 親のタイムラインに接続
     // timeline->add(timeline_);
     
@@ -105,14 +106,18 @@ public:
         });
   }
 
-  // ~ItemReporter() {
-  //   // 親から取り除く
-  //   timeline_->removeSelf();
-  // }
+  ~ItemReporter() {
+    // 親から取り除く
+    // timeline_->removeSelf();
+
+    auto& uniforms = getSharedUniforms();
+    uniforms.release(this);
+    uniforms.release(&light_);
+  }
 
 
   void loadItem(const ci::JsonTree& params, bool new_item = false) {
-    item_ = Item(params);
+    item_ = Item(item_model_.get(params.getValueForKey<std::string>("file")), shader_);
 
     const auto& aabb = item_.getAABB();
     offset_ = -(aabb.getMin() + aabb.getMax()) / 2.0f;
@@ -241,10 +246,12 @@ public:
     // ci::gl::pushModelMatrix();
     {
       ci::gl::ScopedGlslProg shader(shader_);
-    
-      shader_->uniform("LightPosition", light_.direction);
-      shader_->uniform("LightAmbient",  light_.ambient);
-      shader_->uniform("LightDiffuse",  light_.diffuse);
+
+      auto& uniforms = getSharedUniforms();
+      uniforms.setCamera(this, camera_);
+      uniforms.setLight(light_);
+      uniforms.bindCamera(this);
+      uniforms.bindLight(light_);
 
       ci::gl::enableDepth(true);
       ci::gl::enable(GL_CULL_FACE);
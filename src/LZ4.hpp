@@ -0,0 +1,160 @@
+﻿#pragma once
+
+//
+// LZ4のブロック形式
+//   アセットパックを展開するためだけの最小限の実装
+//   圧縮は単純な貪欲法(圧縮率より展開速度を優先する)
+//
+//   SOURCE:https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace ngs { namespace LZ4 {
+
+enum {
+  MIN_MATCH    = 4,
+  // 末尾はリテラルで終わる決まり
+  LAST_LITERALS = 5,
+  MATCH_LIMIT   = 12,
+  MAX_OFFSET    = 65535,
+
+  HASH_BITS = 12,
+};
+
+
+namespace detail {
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void writeLength(std::vector<uint8_t>& dst, size_t length) {
+  while (length >= 255) {
+    dst.push_back(255);
+    length -= 255;
+  }
+  dst.push_back(uint8_t(length));
+}
+
+void writeSequence(std::vector<uint8_t>& dst,
+                   const uint8_t* literals, const size_t literal_num,
+                   const size_t offset, const size_t match_length) {
+  size_t match = (match_length > 0) ? match_length - MIN_MATCH : 0;
+
+  uint8_t token = uint8_t((std::min(literal_num, size_t(15)) << 4) | std::min(match, size_t(15)));
+  dst.push_back(token);
+  if (literal_num >= 15) writeLength(dst, literal_num - 15);
+  dst.insert(std::end(dst), literals, literals + literal_num);
+
+  // 最後のリテラルには一致部分が無い
+  if (match_length == 0) return;
+
+  dst.push_back(uint8_t(offset & 0xff));
+  dst.push_back(uint8_t(offset >> 8));
+  if (match >= 15) writeLength(dst, match - 15);
+}
+
+}
+
+
+// 圧縮
+std::vector<uint8_t> compress(const uint8_t* src, const size_t size) {
+  std::vector<uint8_t> dst;
+  dst.reserve(size + size / 255 + 16);
+
+  size_t anchor = 0;
+  if (size > MATCH_LIMIT) {
+    std::vector<int64_t> table(1 << HASH_BITS, -1);
+
+    size_t limit = size - MATCH_LIMIT;
+    size_t pos = 0;
+    while (pos < limit) {
+      uint32_t sequence = detail::read32(src + pos);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+
+      int64_t ref = table[hash];
+      table[hash] = int64_t(pos);
+
+      if ((ref < 0) || ((pos - size_t(ref)) > MAX_OFFSET) || (detail::read32(src + ref) != sequence)) {
+        pos += 1;
+        continue;
+      }
+
+      size_t length = MIN_MATCH;
+      while (((pos + length) < (size - LAST_LITERALS)) && (src[ref + length] == src[pos + length])) {
+        length += 1;
+      }
+
+      detail::writeSequence(dst, src + anchor, pos - anchor, pos - size_t(ref), length);
+      pos += length;
+      anchor = pos;
+    }
+  }
+
+  detail::writeSequence(dst, src + anchor, size - anchor, 0, 0);
+  return dst;
+}
+
+
+// 展開
+//   dstには展開後の大きさ分の領域を用意しておく
+//   壊れたデータの場合はfalse
+bool decompress(const uint8_t* src, const size_t src_size, uint8_t* dst, const size_t dst_size) {
+  const uint8_t* ip   = src;
+  const uint8_t* iend = src + src_size;
+  uint8_t* op   = dst;
+  uint8_t* oend = dst + dst_size;
+
+  auto readLength = [&ip, iend](size_t length) {
+    if (length != 15) return length;
+
+    uint8_t b;
+    do {
+      if (ip >= iend) return size_t(-1);
+      b = *ip++;
+      length += b;
+    } while (b == 255);
+    return length;
+  };
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t literal_num = readLength(token >> 4);
+    if ((literal_num > size_t(iend - ip)) || (literal_num > size_t(oend - op))) return false;
+    std::memcpy(op, ip, literal_num);
+    ip += literal_num;
+    op += literal_num;
+
+    // 最後のシーケンス
+    if (ip >= iend) break;
+
+    if ((iend - ip) < 2) return false;
+    size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > size_t(op - dst))) return false;
+
+    size_t length = readLength(token & 15);
+    if (length == size_t(-1)) return false;
+    length += MIN_MATCH;
+    if (length > size_t(oend - op)) return false;
+
+    // TIPS:一致部分は重なっていることがあるので1バイトずつコピー
+    const uint8_t* match = op - offset;
+    for (size_t i = 0; i < length; ++i) {
+      op[i] = match[i];
+    }
+    op += length;
+  }
+
+  return op == oend;
+}
+
+} }
@@ -0,0 +1,96 @@
+﻿#pragma once
+
+//
+// ファイルをメモリにマップして読み込む
+//   読み込み用のバッファを用意せず、OSのページキャッシュを直接参照する
+//
+
+#include <cinder/Filesystem.h>
+
+#if defined(CINDER_MSW)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace ngs {
+
+class MappedFile {
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+
+#if defined(CINDER_MSW)
+  HANDLE file_    = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#endif
+
+
+public:
+  explicit MappedFile(const ci::fs::path& path) {
+#if defined(CINDER_MSW)
+    file_ = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || (size.QuadPart == 0)) return;
+
+    mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_) return;
+
+    auto* data = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!data) return;
+
+    data_ = static_cast<const uint8_t*>(data);
+    size_ = size_t(size.QuadPart);
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+      void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(data);
+        size_ = size_t(st.st_size);
+      }
+    }
+
+    // TIPS:マップした後はファイルを閉じても良い
+    close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+#if defined(CINDER_MSW)
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+    if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+
+  bool isOpen() const {
+    return data_ != nullptr;
+  }
+
+  const uint8_t* getData() const {
+    return data_;
+  }
+
+  size_t getSize() const {
+    return size_;
+  }
+
+};
+
+}
@@ -7,9 +7,14 @@
 #include <cinder/Ray.h>
 #include <cinder/TriMesh.h>
 #include <cinder/gl/GlslProg.h>
+#include <cinder/Timer.h>
+#include <map>
+#include <memory>
 #include "Light.hpp"
 #include "Relic.hpp"
+#include "SharedUniforms.hpp"
 #include "shader.hpp"
+#include "Timing.hpp"
 
 
 namespace ngs {
@@ -84,9 +89,66 @@ Light createLight(const ci::JsonTree& params) {
   return light;
 }
 
-ci::gl::GlslProgRef createShader(const std::string& vtx_shader, const std::string& frag_shader) {
-  auto shader = readShader(vtx_shader, frag_shader);
-  return ci::gl::GlslProg::create(shader.first, shader.second);
+// シェーダー生成の統計
+struct ShaderStats {
+  // コンパイルした数と時間(秒)
+  int compiled_num    = 0;
+  double compile_time = 0.0;
+  // 生成済みのものを使い回した数
+  int shared_num = 0;
+};
+
+ShaderStats& getShaderStats() {
+  static ShaderStats stats;
+  return stats;
+}
+
+
+// シェーダーを生成
+//   頂点・フラグメント・マクロの組み合わせが同じなら生成済みのものを使い回す
+//   TIPS:使う側が全て手放したら破棄されるよう弱参照で保持
+ci::gl::GlslProgRef createShader(const std::string& vtx_shader, const std::string& frag_shader,
+                                 const std::vector<std::string>& defines = {}) {
+  static std::map<std::string, std::weak_ptr<ci::gl::GlslProg>> programs;
+
+  std::string key = vtx_shader + ":" + frag_shader;
+  for (const auto& define : defines) {
+    key += ":" + define;
+  }
+
+  auto& stats = getShaderStats();
+
+  auto& program = programs[key];
+  if (auto shader = program.lock()) {
+    stats.shared_num += 1;
+    return shader;
+  }
+
+  ScopedTiming timing("shader " + key);
+  ci::Timer timer(true);
+
+  auto source = readShader(vtx_shader, frag_shader, defines);
+  auto shader = ci::gl::GlslProg::create(source.first, source.second);
+  SharedUniforms::setupBlocks(shader);
+
+  stats.compiled_num += 1;
+  stats.compile_time += timer.getSeconds();
+
+  program = shader;
+  return shader;
+}
+
+// シェーダー生成の統計を出力
+void reportShaderStats() {
+  const auto& stats = getShaderStats();
+
+  // 使い回した分だけコンパイル時間を節約できている
+  double average = stats.compiled_num > 0 ? stats.compile_time / stats.compiled_num : 0.0;
+
+  DOUT << "shader:"
+       << " compiled " << stats.compiled_num << " (" << stats.compile_time * 1000.0 << " ms)"
+       << " shared " << stats.shared_num << " (saved " << average * stats.shared_num * 1000.0 << " ms)"
+       << std::endl;
 }
 
 
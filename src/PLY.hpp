@@ -2,91 +2,533 @@
 
 //
 // PLY読み込み
-// 
-// FIXME:MagicaVoxelから書き出したデータにのみ対応しているので
-//       かなり大雑把
+//   ファイル全体を一度に読み込み、バッファ上で直接数値を読み取る
+//   ヘッダに書かれたプロパティの並びに従うので、列の位置は決め打ちしていない
+//   ascii と binary_little_endian に対応
 //
 
 #include "Path.hpp"
+#include <cinder/Timer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
-#include <sstream> 
-#include <vector> 
+#include <vector>
 
 
 namespace ngs { namespace PLY {
 
-std::vector<std::string> split(const std::string& text) {
-  std::istringstream line_separater(text);
-  const char delimiter = ' ';
+enum class Type {
+  NONE,
 
-  std::vector<std::string> split_text;
-  while (!line_separater.eof()) {
-    std::string separated_string;
-    std::getline(line_separater, separated_string, delimiter);
-    split_text.push_back(separated_string);
+  INT8,
+  UINT8,
+  INT16,
+  UINT16,
+  INT32,
+  UINT32,
+  FLOAT32,
+  FLOAT64,
+};
+
+struct Property {
+  std::string name;
+  Type type;
+
+  // リストの場合は要素数の型
+  bool is_list;
+  Type count_type;
+};
+
+struct Element {
+  std::string name;
+  size_t num;
+
+  std::vector<Property> properties;
+};
+
+
+// 空白と改行を読み飛ばす
+void skipSpaces(const char*& p, const char* end) {
+  while ((p != end) && ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n'))) ++p;
+}
+
+// 整数を読み取る
+//   TIPS:std::from_chars と同じく、読み取った分だけ p を進める
+bool parseInt(const char*& p, const char* end, int64_t& value) {
+  skipSpaces(p, end);
+
+  bool negative = false;
+  if ((p != end) && ((*p == '-') || (*p == '+'))) {
+    negative = (*p == '-');
+    ++p;
+  }
+
+  const char* start = p;
+  int64_t v = 0;
+  while ((p != end) && (*p >= '0') && (*p <= '9')) {
+    v = v * 10 + (*p - '0');
+    ++p;
   }
+  if (p == start) return false;
 
-  return split_text;
+  value = negative ? -v : v;
+  return true;
 }
 
-ci::TriMesh load(const std::string& path) {
-  std::ifstream ifs(getAssetPath(path).string());
+// 実数を読み取る
+//   仮数部を整数で読み取り、最後に10のべき乗を掛ける
+bool parseFloat(const char*& p, const char* end, double& value) {
+  skipSpaces(p, end);
+
+  bool negative = false;
+  if ((p != end) && ((*p == '-') || (*p == '+'))) {
+    negative = (*p == '-');
+    ++p;
+  }
+
+  const char* start = p;
+  double mantissa = 0.0;
+  int exponent = 0;
+  while ((p != end) && (*p >= '0') && (*p <= '9')) {
+    mantissa = mantissa * 10.0 + (*p - '0');
+    ++p;
+  }
+  if ((p != end) && (*p == '.')) {
+    ++p;
+    while ((p != end) && (*p >= '0') && (*p <= '9')) {
+      mantissa = mantissa * 10.0 + (*p - '0');
+      exponent -= 1;
+      ++p;
+    }
+  }
+  if (p == start) return false;
+
+  if ((p != end) && ((*p == 'e') || (*p == 'E'))) {
+    ++p;
+    int64_t e;
+    if (!parseInt(p, end, e)) return false;
+    exponent += int(e);
+  }
+
+  if (exponent != 0) {
+    mantissa *= std::pow(10.0, exponent);
+  }
+
+  value = negative ? -mantissa : mantissa;
+  return true;
+}
+
+
+Type getType(const std::string& name) {
+  static const std::pair<const char*, Type> types[] = {
+    { "char",    Type::INT8 },    { "int8",    Type::INT8 },
+    { "uchar",   Type::UINT8 },   { "uint8",   Type::UINT8 },
+    { "short",   Type::INT16 },   { "int16",   Type::INT16 },
+    { "ushort",  Type::UINT16 },  { "uint16",  Type::UINT16 },
+    { "int",     Type::INT32 },   { "int32",   Type::INT32 },
+    { "uint",    Type::UINT32 },  { "uint32",  Type::UINT32 },
+    { "float",   Type::FLOAT32 }, { "float32", Type::FLOAT32 },
+    { "double",  Type::FLOAT64 }, { "float64", Type::FLOAT64 },
+  };
+
+  for (const auto& t : types) {
+    if (name == t.first) return t.second;
+  }
+  return Type::NONE;
+}
+
+bool isInteger(const Type type) {
+  return (type != Type::FLOAT32) && (type != Type::FLOAT64);
+}
+
+
+// 本体の読み取り
+class Reader {
+  const char* p_;
+  const char* end_;
+  bool binary_;
+  bool failed_ = false;
+
+
+  template <typename T>
+  double readBinary() {
+    if (size_t(end_ - p_) < sizeof(T)) {
+      failed_ = true;
+      return 0.0;
+    }
+
+    // TIPS:対象の環境は全てリトルエンディアンなので、そのまま複製すれば良い
+    T value;
+    std::memcpy(&value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return double(value);
+  }
+
+
+public:
+  Reader(const char* begin, const char* end, const bool binary)
+    : p_(begin),
+      end_(end),
+      binary_(binary)
+  {}
+
+  double read(const Type type) {
+    if (binary_) {
+      switch (type) {
+      case Type::INT8:    return readBinary<int8_t>();
+      case Type::UINT8:   return readBinary<uint8_t>();
+      case Type::INT16:   return readBinary<int16_t>();
+      case Type::UINT16:  return readBinary<uint16_t>();
+      case Type::INT32:   return readBinary<int32_t>();
+      case Type::UINT32:  return readBinary<uint32_t>();
+      case Type::FLOAT32: return readBinary<float>();
+      case Type::FLOAT64: return readBinary<double>();
+      default:
+        failed_ = true;
+        return 0.0;
+      }
+    }
+
+    if (isInteger(type)) {
+      int64_t value;
+      if (!parseInt(p_, end_, value)) {
+        failed_ = true;
+        return 0.0;
+      }
+      return double(value);
+    }
+
+    double value;
+    if (!parseFloat(p_, end_, value)) {
+      failed_ = true;
+      return 0.0;
+    }
+    return value;
+  }
+
+  // プロパティを一つ読み飛ばす
+  void skip(const Property& property) {
+    if (!property.is_list) {
+      read(property.type);
+      return;
+    }
+
+    size_t num = size_t(read(property.count_type));
+    for (size_t i = 0; (i < num) && !failed_; ++i) {
+      read(property.type);
+    }
+  }
+
+  bool isFailed() const {
+    return failed_;
+  }
+
+};
+
+
+// 行の中の単語を切り出す
+//   TIPS:ヘッダは短いので、ここだけは文字列を作っている
+bool nextWord(const char*& p, const char* line_end, std::string& word) {
+  while ((p != line_end) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) ++p;
+  if (p == line_end) return false;
+
+  const char* start = p;
+  while ((p != line_end) && (*p != ' ') && (*p != '\t') && (*p != '\r')) ++p;
+  word.assign(start, p);
+  return true;
+}
+
+// ヘッダ解析
+//   本体の先頭を返す(失敗したらnullptr)
+const char* parseHeader(const char* p, const char* end,
+                        std::vector<Element>& elements, bool& binary) {
+  std::string word;
+  bool has_format = false;
+
+  while (p != end) {
+    const char* line_end = std::find(p, end, '\n');
+    const char* next = (line_end == end) ? end : line_end + 1;
+
+    if (!nextWord(p, line_end, word)) {
+      p = next;
+      continue;
+    }
+
+    if (word == "format") {
+      nextWord(p, line_end, word);
+      if (word == "ascii") {
+        binary = false;
+      }
+      else if (word == "binary_little_endian") {
+        binary = true;
+      }
+      else {
+        DOUT << "PLY: unsupported format " << word << std::endl;
+        return nullptr;
+      }
+      has_format = true;
+    }
+    else if (word == "element") {
+      Element element;
+      nextWord(p, line_end, element.name);
+
+      int64_t num;
+      if (!parseInt(p, line_end, num) || (num < 0)
+          || ((p != line_end) && (*p != ' ') && (*p != '\t') && (*p != '\r'))) {
+        DOUT << "PLY: invalid element " << element.name << std::endl;
+        return nullptr;
+      }
+      element.num = size_t(num);
+      elements.push_back(element);
+    }
+    else if (word == "property" && !elements.empty()) {
+      Property property;
+      nextWord(p, line_end, word);
+      if (word == "list") {
+        property.is_list = true;
+        nextWord(p, line_end, word);
+        property.count_type = getType(word);
+        nextWord(p, line_end, word);
+        property.type = getType(word);
+      }
+      else {
+        property.is_list    = false;
+        property.count_type = Type::NONE;
+        property.type       = getType(word);
+      }
+      nextWord(p, line_end, property.name);
+
+      if (property.type == Type::NONE || (property.is_list && property.count_type == Type::NONE)) {
+        DOUT << "PLY: unsupported property " << property.name << std::endl;
+        return nullptr;
+      }
+      elements.back().properties.push_back(property);
+    }
+    else if (word == "end_header") {
+      if (!has_format) return nullptr;
+
+      // 壊れたヘッダの数で大きな領域を確保しないよう、本体の大きさと比べておく
+      // TIPS:どの形式でもプロパティ1つにつき1バイト以上使う
+      size_t remaining = size_t(end - next);
+      for (const auto& element : elements) {
+        size_t property_num = element.properties.size();
+        if (property_num == 0) continue;
+        if (element.num > (remaining / property_num)) {
+          DOUT << "PLY: too many elements " << element.name << " " << element.num << std::endl;
+          return nullptr;
+        }
+        remaining -= element.num * property_num;
+      }
+      return next;
+    }
+
+    p = next;
+  }
+
+  return nullptr;
+}
+
+
+// 頂点プロパティの用途
+enum Usage {
+  POSITION_X, POSITION_Y, POSITION_Z,
+  NORMAL_X, NORMAL_Y, NORMAL_Z,
+  COLOR_R, COLOR_G, COLOR_B,
+
+  USAGE_NUM,
+  UNUSED = USAGE_NUM
+};
+
+int getUsage(const std::string& name) {
+  static const char* names[] = {
+    "x", "y", "z",
+    "nx", "ny", "nz",
+    "red", "green", "blue",
+  };
+
+  for (int i = 0; i < USAGE_NUM; ++i) {
+    if (name == names[i]) return i;
+  }
+  return UNUSED;
+}
+
+
+// メモリ上のPLYを読み込む
+ci::TriMesh parse(const char* begin, const char* end) {
+  std::vector<Element> elements;
+  bool binary = false;
+  const char* body = parseHeader(begin, end, elements, binary);
+  if (!body) {
+    DOUT << "PLY: invalid header" << std::endl;
+    return ci::TriMesh(ci::TriMesh::Format().positions().normals().colors());
+  }
+
+  // 法線が含まれていなければ、読み込んだ後に計算する
+  bool has_normals = false;
+  for (const auto& element : elements) {
+    if (element.name != "vertex") continue;
+
+    for (const auto& property : element.properties) {
+      if (getUsage(property.name) == NORMAL_X) has_normals = true;
+    }
+  }
 
   // 頂点カラーを含むTriMeshを準備
   ci::TriMesh mesh(ci::TriMesh::Format().positions().normals().colors());
 
-  int vertex_num = 0;
-  int face_num = 0;
+  Reader reader(body, end, binary);
+  for (const auto& element : elements) {
+    if (element.name == "vertex") {
+      // TIPS:ヘッダの数で先に確保しておく
+      mesh.getBufferPositions().reserve(element.num * 3);
+      mesh.getBufferColors().reserve(element.num * 3);
+      mesh.getNormals().reserve(element.num);
+
+      // 色は整数なら0~255
+      std::vector<int> usages;
+      std::vector<float> scales;
+      for (const auto& property : element.properties) {
+        usages.push_back(property.is_list ? UNUSED : getUsage(property.name));
+        scales.push_back(isInteger(property.type) ? (1.0f / 255.0f) : 1.0f);
+      }
+
+      float values[USAGE_NUM] = {};
+      for (size_t i = 0; (i < element.num) && !reader.isFailed(); ++i) {
+        for (size_t j = 0; j < element.properties.size(); ++j) {
+          const auto& property = element.properties[j];
+          if (usages[j] == UNUSED) {
+            reader.skip(property);
+            continue;
+          }
 
-  // ヘッダ解析
-  while (!ifs.eof()) {
-    // １行読み込む
-    std::string line_buffer;
-    std::getline(ifs, line_buffer);
+          float value = float(reader.read(property.type));
+          values[usages[j]] = (usages[j] >= COLOR_R) ? value * scales[j] : value;
+        }
 
-    auto split_text = split(line_buffer);
-    if (split_text[0] == "element" && split_text[1] == "vertex") {
-      // 頂点数
-      vertex_num = std::stoi(split_text[2]);
+        mesh.appendPosition(ci::vec3(values[POSITION_X], values[POSITION_Y], values[POSITION_Z]));
+        mesh.appendColorRgb(ci::Color(values[COLOR_R], values[COLOR_G], values[COLOR_B]));
+        if (has_normals) {
+          mesh.appendNormal(ci::vec3(values[NORMAL_X], values[NORMAL_Y], values[NORMAL_Z]));
+        }
+      }
     }
-    else if (split_text[0] == "element" && split_text[1] == "face") {
-      // ポリゴン数
-      face_num = std::stoi(split_text[2]);
+    else if (element.name == "face") {
+      // 大抵は三角形か四角形
+      mesh.getIndices().reserve(element.num * 3);
+
+      for (size_t i = 0; (i < element.num) && !reader.isFailed(); ++i) {
+        for (const auto& property : element.properties) {
+          if (!property.is_list || ((property.name != "vertex_indices") && (property.name != "vertex_index"))) {
+            reader.skip(property);
+            continue;
+          }
+
+          // 多角形は扇状に三角形へ分割
+          size_t num = size_t(reader.read(property.count_type));
+          uint32_t first = 0;
+          uint32_t prev  = 0;
+          for (size_t k = 0; k < num; ++k) {
+            uint32_t index = uint32_t(reader.read(property.type));
+            if (k == 0) {
+              first = index;
+            }
+            else if (k >= 2) {
+              mesh.appendTriangle(first, prev, index);
+            }
+            prev = index;
+          }
+        }
+      }
     }
-    else if (split_text[0] == "end_header") {
-      // ヘッダ終了
-      break;
+    else {
+      for (size_t i = 0; (i < element.num) && !reader.isFailed(); ++i) {
+        for (const auto& property : element.properties) {
+          reader.skip(property);
+        }
+      }
     }
   }
 
-  assert((vertex_num != 0) && (face_num != 0));
-  
-  for (int i = 0; i < vertex_num; ++i) {
-    std::string line_buffer;
-    std::getline(ifs, line_buffer);
-    auto split_text = split(line_buffer);
+  if (reader.isFailed()) {
+    DOUT << "PLY: unexpected end of data" << std::endl;
+  }
+
+  if (!has_normals) {
+    mesh.recalculateNormals();
+  }
 
-    ci::vec3 p(std::stof(split_text[0]), std::stof(split_text[1]), std::stof(split_text[2]));
-    mesh.appendPosition(p);
+  return mesh;
+}
 
-    ci::Color c(std::stof(split_text[3]) / 255.0f, std::stof(split_text[4]) / 255.0f, std::stof(split_text[5]) / 255.0f);
-    mesh.appendColorRgb(c);
+
+// ファイル全体を一度に読み込む
+bool readFile(const ci::fs::path& path, std::vector<char>& buffer) {
+  std::ifstream ifs(path.string(), std::ios::binary);
+  if (!ifs) return false;
+
+  ifs.seekg(0, std::ios::end);
+  buffer.resize(size_t(ifs.tellg()));
+  ifs.seekg(0, std::ios::beg);
+  if (!buffer.empty()) {
+    ifs.read(&buffer[0], buffer.size());
   }
-  
-  for (int i = 0; i < face_num; ++i) {
-    std::string line_buffer;
-    std::getline(ifs, line_buffer);
-    auto split_text = split(line_buffer);
 
-    uint32_t v0 = std::stoul(split_text[1]);
-    uint32_t v1 = std::stoul(split_text[2]);
-    uint32_t v2 = std::stoul(split_text[3]);
-    mesh.appendTriangle(v0, v1, v2);
+  return bool(ifs);
+}
+
+ci::TriMesh load(const std::string& path) {
+  std::vector<char> buffer;
+  if (!readFile(getAssetPath(path), buffer) || buffer.empty()) {
+    DOUT << "PLY: can't read " << path << std::endl;
+    return ci::TriMesh(ci::TriMesh::Format().positions().normals().colors());
   }
 
-  mesh.recalculateNormals();
+  const char* begin = &buffer[0];
+  return parse(begin, begin + buffer.size());
+}
 
-  return mesh;
+
+// assets内の全てのPLYの読み込み時間を計測
+void benchmark(const int repeat = 20) {
+  auto directory = getAssetPath("ship.ply").parent_path();
+
+  size_t total_bytes = 0;
+  double total_time  = 0.0;
+
+  for (ci::fs::directory_iterator it(directory), end; it != end; ++it) {
+    const auto& path = it->path();
+    if (path.extension() != ".ply") continue;
+
+    std::vector<char> buffer;
+    if (!readFile(path, buffer) || buffer.empty()) continue;
+
+    // ファイルの読み込みは除いて、解析だけを計測する
+    ci::Timer timer(true);
+    size_t vertex_num = 0;
+    size_t triangle_num = 0;
+    for (int i = 0; i < repeat; ++i) {
+      auto mesh = parse(&buffer[0], &buffer[0] + buffer.size());
+      vertex_num   = mesh.getNumVertices();
+      triangle_num = mesh.getNumTriangles();
+    }
+    double time = timer.getSeconds() / repeat;
+
+    DOUT << "PLY: " << path.filename().string()
+         << " " << buffer.size() / 1024 << " KB"
+         << " vertices " << vertex_num
+         << " triangles " << triangle_num
+         << " " << time * 1000.0 << " ms"
+         << std::endl;
+
+    total_bytes += buffer.size();
+    total_time  += time;
+  }
+
+  DOUT << "PLY: total " << total_bytes / 1024 << " KB "
+       << total_time * 1000.0 << " ms"
+       << " (" << (total_time > 0.0 ? (total_bytes / (1024.0 * 1024.0)) / total_time : 0.0) << " MB/s)"
+       << std::endl;
 }
 
 } }
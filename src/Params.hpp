@@ -2,16 +2,91 @@
 
 //
 // アプリ内パラメーター
+//   params.jsonはプロセス内で一度だけ読み込み、全体で共有する
+//   毎フレームや操作のたびに参照する値は、読み込み時に型付きの値へ変換しておく
+//   生成時にだけ使う値は、これまで通りjsonから読む
 //
 
 #include <cinder/Json.h>
+#include <map>
 #include "Asset.hpp"
+#include "JsonUtil.hpp"
+#include "Timing.hpp"
 
 
-namespace ngs { namespace Params {
+namespace ngs {
 
-ci::JsonTree load(const std::string& path) {
-  return ci::JsonTree(Asset::load(path));
-}
+struct Params {
+  // ウインドウなどの設定
+  struct App {
+    ci::ivec2 size;
+    bool power_management;
+    bool high_density_display;
+    int frame_rate;
+  };
+
+  // 収集アイテム
+  struct Item {
+    std::string name;
+    std::string file;
+    double probability;
+  };
+
+
+  ci::JsonTree json;
+
+  App app;
+  std::vector<Item> items;
+  // キー(大文字小文字を区別) → signal
+  std::map<char, std::string> debug_signal;
+
+
+  // 読み込んで変換する
+  //   TIPS:必須の値が無い場合はJsonTreeの例外がそのまま投げられる
+  static Params load(const std::string& path) {
+    ScopedTiming timing("params");
+
+    Params params;
+    params.json = ci::JsonTree(Asset::load(path));
+    const auto& json = params.json;
 
-} }
+    params.app = {
+      Json::getVec<ci::ivec2>(json["app.size"]),
+      json.getValueForKey<bool>("app.power_management"),
+      json.getValueForKey<bool>("app.high_density_display"),
+      json.getValueForKey<int>("app.frame_rate"),
+    };
+
+    for (const auto& p : json["item.body"]) {
+      Item item = {
+        p.getValueForKey<std::string>("name"),
+        p.getValueForKey<std::string>("file"),
+        p.getValueForKey<double>("probability"),
+      };
+      assert(item.probability >= 0.0);
+      params.items.push_back(item);
+    }
+    assert(!params.items.empty());
+
+    for (const auto& p : json["debug_signal"]) {
+      const auto& key = p.getKey();
+      if (key.size() != 1) {
+        DOUT << "debug_signal: invalid key " << key << std::endl;
+        continue;
+      }
+      params.debug_signal.insert(std::make_pair(key[0], p.getValue<std::string>()));
+    }
+
+    return params;
+  }
+
+  // プロセス内で共有するパラメーター
+  //   TIPS:最初に呼ばれた時に読み込む
+  static const Params& get() {
+    static const Params params = load("params.json");
+    return params;
+  }
+
+};
+
+}
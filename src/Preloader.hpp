@@ -0,0 +1,208 @@
+﻿#pragma once
+
+//
+// 起動時の先読み
+//   ファイルの読み込みや展開を複数のスレッドで並行して行う
+//   GLやオーディオの生成は、依存する先読みが終わった後にメインスレッドで行う
+//
+//   TIPS:メインスレッドの作業は1フレームに1つずつ実行するので、
+//        その間も読み込み中の画面を描画できる
+//
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Timing.hpp"
+
+
+namespace ngs {
+
+class Preloader {
+  struct Task {
+    std::string name;
+    std::function<void ()> work;
+    bool main_thread;
+
+    // 終わっていない依存先の数
+    int waiting;
+    std::vector<size_t> dependents;
+  };
+
+  std::vector<Task> tasks_;
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+
+  // 実行できる作業
+  std::deque<size_t> ready_;
+  std::deque<size_t> main_ready_;
+
+  size_t done_num_ = 0;
+  bool started_ = false;
+  bool quit_    = false;
+
+  // 作業ごとの計測をまとめる区間
+  int timing_parent_ = -1;
+
+
+  // 作業が終わった(mutex_をロックして呼ぶ)
+  void finish(const size_t index) {
+    done_num_ += 1;
+
+    for (auto i : tasks_[index].dependents) {
+      auto& task = tasks_[i];
+      task.waiting -= 1;
+      if (task.waiting == 0) {
+        (task.main_thread ? main_ready_ : ready_).push_back(i);
+      }
+    }
+
+    condition_.notify_all();
+  }
+
+  void threadMain() {
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]() { return quit_ || !ready_.empty(); });
+        if (quit_) return;
+
+        index = ready_.front();
+        ready_.pop_front();
+      }
+
+      // 失敗した場合、使う側で同期的に読み込み直すので処理は続ける
+      try {
+        ScopedTiming timing(tasks_[index].name, timing_parent_);
+        tasks_[index].work();
+      }
+      catch (const std::exception& e) {
+        DOUT << "preload failed: " << tasks_[index].name << " " << e.what() << std::endl;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      finish(index);
+    }
+  }
+
+  size_t find(const std::string& name) const {
+    auto it = std::find_if(std::begin(tasks_), std::end(tasks_),
+                           [&name](const Task& task) {
+                             return task.name == name;
+                           });
+    assert(it != std::end(tasks_));
+    return std::distance(std::begin(tasks_), it);
+  }
+
+
+public:
+  Preloader() = default;
+
+  ~Preloader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    condition_.notify_all();
+
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  Preloader(const Preloader&) = delete;
+  Preloader& operator=(const Preloader&) = delete;
+
+
+  // 作業を追加(start前に呼ぶ)
+  //   depends     先に終わっている必要のある作業の名前
+  //   main_thread trueならメインスレッドのupdateで実行
+  void add(const std::string& name, std::function<void ()> work,
+           const std::vector<std::string>& depends = {},
+           const bool main_thread = false) {
+    assert(!started_);
+
+    Task task;
+    task.name        = name;
+    task.work        = std::move(work);
+    task.main_thread = main_thread;
+    task.waiting     = int(depends.size());
+
+    size_t index = tasks_.size();
+    for (const auto& depend : depends) {
+      tasks_[find(depend)].dependents.push_back(index);
+    }
+    tasks_.push_back(std::move(task));
+  }
+
+  void addMain(const std::string& name, std::function<void ()> work,
+               const std::vector<std::string>& depends = {}) {
+    add(name, std::move(work), depends, true);
+  }
+
+
+  // timing_parent 作業ごとの計測をまとめる区間
+  void start(const int timing_parent = -1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = true;
+    timing_parent_ = timing_parent;
+
+    for (size_t i = 0; i < tasks_.size(); ++i) {
+      if (tasks_[i].waiting > 0) continue;
+      (tasks_[i].main_thread ? main_ready_ : ready_).push_back(i);
+    }
+
+    // TIPS:メインスレッドの分を残す
+    size_t num = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    num = std::min(num, size_t(4));
+    for (size_t i = 0; i < num; ++i) {
+      threads_.emplace_back(&Preloader::threadMain, this);
+    }
+  }
+
+  // メインスレッドの作業を1つ実行
+  void update() {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (main_ready_.empty()) return;
+
+      index = main_ready_.front();
+      main_ready_.pop_front();
+    }
+
+    {
+      ScopedTiming timing(tasks_[index].name, timing_parent_);
+      tasks_[index].work();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    finish(index);
+  }
+
+
+  bool isDone() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_num_ == tasks_.size();
+  }
+
+  // 進み具合(0.0~1.0)
+  float getProgress() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.empty() ? 1.0f : float(done_num_) / tasks_.size();
+  }
+
+
+  size_t getThreadNum() const {
+    return threads_.size();
+  }
+
+};
+
+}
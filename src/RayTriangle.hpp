@@ -0,0 +1,288 @@
+﻿#pragma once
+
+//
+// Rayと三角形の交差判定
+//   三角形をSoA形式で保持し、SIMD命令で4つずつ判定する
+//   判定内容はci::Ray::calcTriangleIntersectionと同じ
+//
+
+#include <cinder/Ray.h>
+#include <cinder/TriMesh.h>
+#include <vector>
+#include <limits>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define NGS_RAY_TRIANGLE_SSE
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+// TIPS:除算命令(vdivq_f32)があるarm64のみ
+#include <arm_neon.h>
+#define NGS_RAY_TRIANGLE_NEON
+#endif
+
+
+namespace ngs { namespace RayTriangle {
+
+// 一度に判定する三角形の数
+enum {
+  PACKET_SIZE = 4,
+};
+
+
+// SoA形式の三角形
+//   頂点0と、頂点0から頂点1・頂点2への辺を持つ
+struct Triangles {
+  std::vector<float> v0[3];
+  std::vector<float> e1[3];
+  std::vector<float> e2[3];
+
+  // パディングを含まない三角形の数
+  size_t num = 0;
+
+
+  Triangles() = default;
+
+  explicit Triangles(const ci::TriMesh& mesh) {
+    const auto* vertex  = mesh.getPositions<3>();
+    const auto& indices = mesh.getIndices();
+
+    num = indices.size() / 3;
+
+    // TIPS:PACKET_SIZEの倍数になるよう、面積0の三角形で埋める
+    //      (判定では必ず不成立になる)
+    size_t size = (num + PACKET_SIZE - 1) / PACKET_SIZE * PACKET_SIZE;
+    for (int i = 0; i < 3; ++i) {
+      v0[i].resize(size, 0.0f);
+      e1[i].resize(size, 0.0f);
+      e2[i].resize(size, 0.0f);
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+      const auto& p0 = vertex[indices[i * 3 + 0]];
+      const auto& p1 = vertex[indices[i * 3 + 1]];
+      const auto& p2 = vertex[indices[i * 3 + 2]];
+
+      ci::vec3 edge1 = p1 - p0;
+      ci::vec3 edge2 = p2 - p0;
+      for (int j = 0; j < 3; ++j) {
+        v0[j][i] = p0[j];
+        e1[j][i] = edge1[j];
+        e2[j][i] = edge2[j];
+      }
+    }
+  }
+
+  // パディングを含む要素数
+  size_t size() const {
+    return v0[0].size();
+  }
+};
+
+
+// SIMD版が使えるか
+bool hasSimd() {
+#if defined (NGS_RAY_TRIANGLE_SSE) || defined (NGS_RAY_TRIANGLE_NEON)
+  return true;
+#else
+  return false;
+#endif
+}
+
+// 実行時の切り替え
+//   SIMD版が使えない場合は常にスカラー版
+bool& useSimd() {
+  static bool use_simd = hasSimd();
+  return use_simd;
+}
+
+
+// スカラー版
+std::pair<bool, float> intersectScalar(const ci::Ray& ray, const Triangles& triangles) {
+  const float EPSILON = 0.000001f;
+
+  const auto& o = ray.getOrigin();
+  const auto& d = ray.getDirection();
+
+  bool  cross       = false;
+  float cross_min_z = std::numeric_limits<float>::max();
+
+  for (size_t i = 0; i < triangles.num; ++i) {
+    ci::vec3 edge1(triangles.e1[0][i], triangles.e1[1][i], triangles.e1[2][i]);
+    ci::vec3 edge2(triangles.e2[0][i], triangles.e2[1][i], triangles.e2[2][i]);
+
+    ci::vec3 pvec = glm::cross(d, edge2);
+    float det = glm::dot(edge1, pvec);
+    if (det > -EPSILON && det < EPSILON) continue;
+
+    float inv_det = 1.0f / det;
+    ci::vec3 tvec = o - ci::vec3(triangles.v0[0][i], triangles.v0[1][i], triangles.v0[2][i]);
+    float u = glm::dot(tvec, pvec) * inv_det;
+    if (u < 0.0f || u > 1.0f) continue;
+
+    ci::vec3 qvec = glm::cross(tvec, edge1);
+    float v = glm::dot(d, qvec) * inv_det;
+    if (v < 0.0f || (u + v) > 1.0f) continue;
+
+    cross = true;
+    cross_min_z = std::min(glm::dot(edge2, qvec) * inv_det, cross_min_z);
+  }
+
+  return std::make_pair(cross, cross_min_z);
+}
+
+
+#if defined (NGS_RAY_TRIANGLE_SSE)
+
+// SSE版
+std::pair<bool, float> intersectSimd(const ci::Ray& ray, const Triangles& triangles) {
+  const __m128 eps     = _mm_set1_ps(0.000001f);
+  const __m128 neg_eps = _mm_set1_ps(-0.000001f);
+  const __m128 zero    = _mm_setzero_ps();
+  const __m128 one     = _mm_set1_ps(1.0f);
+
+  const auto& o = ray.getOrigin();
+  const auto& d = ray.getDirection();
+  const __m128 ox = _mm_set1_ps(o.x);
+  const __m128 oy = _mm_set1_ps(o.y);
+  const __m128 oz = _mm_set1_ps(o.z);
+  const __m128 dx = _mm_set1_ps(d.x);
+  const __m128 dy = _mm_set1_ps(d.y);
+  const __m128 dz = _mm_set1_ps(d.z);
+
+  __m128 cross_min_z = _mm_set1_ps(std::numeric_limits<float>::max());
+  __m128 cross       = zero;
+
+  for (size_t i = 0; i < triangles.size(); i += PACKET_SIZE) {
+    __m128 e1x = _mm_loadu_ps(&triangles.e1[0][i]);
+    __m128 e1y = _mm_loadu_ps(&triangles.e1[1][i]);
+    __m128 e1z = _mm_loadu_ps(&triangles.e1[2][i]);
+    __m128 e2x = _mm_loadu_ps(&triangles.e2[0][i]);
+    __m128 e2y = _mm_loadu_ps(&triangles.e2[1][i]);
+    __m128 e2z = _mm_loadu_ps(&triangles.e2[2][i]);
+
+    // pvec = cross(d, edge2)
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 mask = _mm_or_ps(_mm_cmple_ps(det, neg_eps), _mm_cmpge_ps(det, eps));
+    if (!_mm_movemask_ps(mask)) continue;
+
+    __m128 inv_det = _mm_div_ps(one, det);
+
+    __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(&triangles.v0[0][i]));
+    __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(&triangles.v0[1][i]));
+    __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(&triangles.v0[2][i]));
+
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+    if (!_mm_movemask_ps(mask)) continue;
+
+    // qvec = cross(tvec, edge1)
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(e1y, tz));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(e1z, tx));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(e1x, ty));
+
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+    if (!_mm_movemask_ps(mask)) continue;
+
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    // 交差したものだけ最小値を更新
+    cross_min_z = _mm_or_ps(_mm_and_ps(mask, _mm_min_ps(t, cross_min_z)),
+                            _mm_andnot_ps(mask, cross_min_z));
+    cross = _mm_or_ps(cross, mask);
+  }
+
+  float z[PACKET_SIZE];
+  _mm_storeu_ps(z, cross_min_z);
+
+  return std::make_pair(_mm_movemask_ps(cross) != 0,
+                        std::min(std::min(z[0], z[1]), std::min(z[2], z[3])));
+}
+
+#elif defined (NGS_RAY_TRIANGLE_NEON)
+
+// NEON版
+std::pair<bool, float> intersectSimd(const ci::Ray& ray, const Triangles& triangles) {
+  const float32x4_t eps     = vdupq_n_f32(0.000001f);
+  const float32x4_t neg_eps = vdupq_n_f32(-0.000001f);
+  const float32x4_t zero    = vdupq_n_f32(0.0f);
+  const float32x4_t one     = vdupq_n_f32(1.0f);
+
+  const auto& o = ray.getOrigin();
+  const auto& d = ray.getDirection();
+  const float32x4_t ox = vdupq_n_f32(o.x);
+  const float32x4_t oy = vdupq_n_f32(o.y);
+  const float32x4_t oz = vdupq_n_f32(o.z);
+  const float32x4_t dx = vdupq_n_f32(d.x);
+  const float32x4_t dy = vdupq_n_f32(d.y);
+  const float32x4_t dz = vdupq_n_f32(d.z);
+
+  float32x4_t cross_min_z = vdupq_n_f32(std::numeric_limits<float>::max());
+  uint32x4_t  cross       = vdupq_n_u32(0);
+
+  for (size_t i = 0; i < triangles.size(); i += PACKET_SIZE) {
+    float32x4_t e1x = vld1q_f32(&triangles.e1[0][i]);
+    float32x4_t e1y = vld1q_f32(&triangles.e1[1][i]);
+    float32x4_t e1z = vld1q_f32(&triangles.e1[2][i]);
+    float32x4_t e2x = vld1q_f32(&triangles.e2[0][i]);
+    float32x4_t e2y = vld1q_f32(&triangles.e2[1][i]);
+    float32x4_t e2z = vld1q_f32(&triangles.e2[2][i]);
+
+    // pvec = cross(d, edge2)
+    float32x4_t px = vsubq_f32(vmulq_f32(dy, e2z), vmulq_f32(e2y, dz));
+    float32x4_t py = vsubq_f32(vmulq_f32(dz, e2x), vmulq_f32(e2z, dx));
+    float32x4_t pz = vsubq_f32(vmulq_f32(dx, e2y), vmulq_f32(e2x, dy));
+
+    float32x4_t det = vaddq_f32(vaddq_f32(vmulq_f32(e1x, px), vmulq_f32(e1y, py)), vmulq_f32(e1z, pz));
+    uint32x4_t mask = vorrq_u32(vcleq_f32(det, neg_eps), vcgeq_f32(det, eps));
+    if (!vmaxvq_u32(mask)) continue;
+
+    float32x4_t inv_det = vdivq_f32(one, det);
+
+    float32x4_t tx = vsubq_f32(ox, vld1q_f32(&triangles.v0[0][i]));
+    float32x4_t ty = vsubq_f32(oy, vld1q_f32(&triangles.v0[1][i]));
+    float32x4_t tz = vsubq_f32(oz, vld1q_f32(&triangles.v0[2][i]));
+
+    float32x4_t u = vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(tx, px), vmulq_f32(ty, py)), vmulq_f32(tz, pz)), inv_det);
+    mask = vandq_u32(mask, vandq_u32(vcgeq_f32(u, zero), vcleq_f32(u, one)));
+    if (!vmaxvq_u32(mask)) continue;
+
+    // qvec = cross(tvec, edge1)
+    float32x4_t qx = vsubq_f32(vmulq_f32(ty, e1z), vmulq_f32(e1y, tz));
+    float32x4_t qy = vsubq_f32(vmulq_f32(tz, e1x), vmulq_f32(e1z, tx));
+    float32x4_t qz = vsubq_f32(vmulq_f32(tx, e1y), vmulq_f32(e1x, ty));
+
+    float32x4_t v = vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(dx, qx), vmulq_f32(dy, qy)), vmulq_f32(dz, qz)), inv_det);
+    mask = vandq_u32(mask, vandq_u32(vcgeq_f32(v, zero), vcleq_f32(vaddq_f32(u, v), one)));
+    if (!vmaxvq_u32(mask)) continue;
+
+    float32x4_t t = vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(e2x, qx), vmulq_f32(e2y, qy)), vmulq_f32(e2z, qz)), inv_det);
+
+    // 交差したものだけ最小値を更新
+    cross_min_z = vbslq_f32(mask, vminq_f32(t, cross_min_z), cross_min_z);
+    cross = vorrq_u32(cross, mask);
+  }
+
+  return std::make_pair(vmaxvq_u32(cross) != 0, vminvq_f32(cross_min_z));
+}
+
+#else
+
+// SIMD命令が使えない環境
+std::pair<bool, float> intersectSimd(const ci::Ray& ray, const Triangles& triangles) {
+  return intersectScalar(ray, triangles);
+}
+
+#endif
+
+
+std::pair<bool, float> intersect(const ci::Ray& ray, const Triangles& triangles) {
+  return useSimd() ? intersectSimd(ray, triangles)
+                   : intersectScalar(ray, triangles);
+}
+
+} }
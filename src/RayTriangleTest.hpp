@@ -0,0 +1,138 @@
+﻿#pragma once
+
+//
+// Rayと三角形の交差判定の検証
+//   生成した地形へRayを飛ばし、SIMD版・スカラー版・ci::Rayでの判定が一致するか調べる
+//   DEBUGビルドの起動時に実行する
+//
+//   TIPS:三つとも同じ順序で計算しているので、辺や頂点を狙っても結果は変わらない
+//
+
+#include <cinder/Perlin.h>
+#include <cinder/Rand.h>
+#include <cinder/Ray.h>
+#include <cinder/TriMesh.h>
+#include <cassert>
+#include "JsonUtil.hpp"
+#include "Misc.hpp"
+#include "RayTriangle.hpp"
+#include "Stage.hpp"
+#include "StageObjFactory.hpp"
+
+
+namespace ngs { namespace RayTriangleTest {
+
+struct Result {
+  int ray_num = 0;
+  int hit_num = 0;
+};
+
+
+// 三つの判定が一致するか
+void check(const ci::Ray& ray, const ci::TriMesh& mesh, const RayTriangle::Triangles& triangles,
+           Result& result) {
+  auto expected = intersect(ray, mesh);
+  auto scalar   = RayTriangle::intersectScalar(ray, triangles);
+  auto simd     = RayTriangle::intersectSimd(ray, triangles);
+
+  result.ray_num += 1;
+  if (expected.first) result.hit_num += 1;
+
+  for (const auto& actual : { scalar, simd }) {
+    assert(actual.first == expected.first);
+    if (!expected.first) continue;
+
+    float epsilon = 0.0001f * std::max(std::abs(expected.second), 1.0f);
+    assert(std::abs(actual.second - expected.second) <= epsilon);
+  }
+}
+
+// 上空から点を狙うRay
+ci::Ray createRayTo(const ci::vec3& target) {
+  ci::vec3 origin = target + ci::vec3(ci::randFloat(-8, 8), ci::randFloat(20, 40), ci::randFloat(-8, 8));
+  return ci::Ray(origin, glm::normalize(target - origin));
+}
+
+
+// ランダムなRayと、三角形の頂点・辺を狙ったRay
+void testMesh(const ci::TriMesh& mesh, const float size, Result& result) {
+  enum {
+    RAY_NUM = 200,
+    // 辺を狙う三角形の間隔
+    EDGE_STEP = 7,
+  };
+
+  RayTriangle::Triangles triangles(mesh);
+  assert(triangles.num == mesh.getNumTriangles());
+  assert((triangles.size() % RayTriangle::PACKET_SIZE) == 0);
+
+  for (int i = 0; i < RAY_NUM; ++i) {
+    ci::vec3 origin(ci::randFloat(0, size), ci::randFloat(20, 40), ci::randFloat(0, size));
+    ci::vec3 direction(ci::randFloat(-1, 1), ci::randFloat(-1, -0.1), ci::randFloat(-1, 1));
+    check(ci::Ray(origin, glm::normalize(direction)), mesh, triangles, result);
+  }
+
+  const auto* vertex  = mesh.getPositions<3>();
+  const auto& indices = mesh.getIndices();
+  for (size_t i = 0; i < triangles.num; i += EDGE_STEP) {
+    const auto& p0 = vertex[indices[i * 3 + 0]];
+    const auto& p1 = vertex[indices[i * 3 + 1]];
+    const auto& p2 = vertex[indices[i * 3 + 2]];
+
+    // 頂点と、u == 0・v == 0・u + v == 1 になる辺の中点
+    for (const auto& target : { p0, (p0 + p1) * 0.5f, (p0 + p2) * 0.5f, (p1 + p2) * 0.5f }) {
+      check(createRayTo(target), mesh, triangles, result);
+    }
+  }
+}
+
+// パディングの三角形は交差しない
+//   TIPS:パディングは原点に置かれるので、原点を狙っても外れる
+void testPadding(Result& result) {
+  ci::TriMesh mesh(ci::TriMesh::Format().positions());
+  // PACKET_SIZEの倍数にならない数
+  for (int i = 0; i < 5; ++i) {
+    ci::vec3 base(i * 2.0f + 1.0f, 0.0f, 1.0f);
+    mesh.appendPosition(base);
+    mesh.appendPosition(base + ci::vec3(1, 0, 0));
+    mesh.appendPosition(base + ci::vec3(0, 0, 1));
+    mesh.appendTriangle(i * 3 + 0, i * 3 + 2, i * 3 + 1);
+  }
+
+  RayTriangle::Triangles triangles(mesh);
+  assert(triangles.num == 5);
+  assert(triangles.size() == 8);
+
+  for (int i = 0; i < 10; ++i) {
+    auto ray = createRayTo(ci::vec3(0, 0, 0));
+    assert(!RayTriangle::intersectScalar(ray, triangles).first);
+    assert(!RayTriangle::intersectSimd(ray, triangles).first);
+    check(ray, mesh, triangles, result);
+  }
+
+  testMesh(mesh, 11.0f, result);
+}
+
+
+void test(const ci::JsonTree& params) {
+  enum { BLOCK_SIZE = 64 };
+
+  ci::Perlin random(params.getValueForKey<int>("stage.octave"), params.getValueForKey<int>("stage.seed"));
+  auto random_scale = Json::getVec<ci::vec3>(params["stage.random_scale"]);
+  StageObjFactory factory(params["stage_obj"]);
+
+  Result result;
+  const ci::ivec2 positions[] = { { 0, 0 }, { 1, 0 }, { -1, 2 } };
+  for (const auto& pos : positions) {
+    Stage stage(BLOCK_SIZE, BLOCK_SIZE, pos.x, pos.y, random, factory, random_scale);
+    testMesh(stage.getLandMesh(), BLOCK_SIZE, result);
+  }
+  testPadding(result);
+
+  DOUT << "RayTriangleTest: rays " << result.ray_num
+       << " hit " << result.hit_num
+       << " simd " << RayTriangle::hasSimd()
+       << std::endl;
+}
+
+} }
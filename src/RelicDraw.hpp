@@ -2,23 +2,84 @@
 
 //
 // ステージ上の遺物の描画
+//   見えている遺物をまとめてインスタンス描画する
 //
 
+#include <cstddef>
+#include "VisibleSet.hpp"
+#include "RenderQueue.hpp"
+#include "CookedMesh.hpp"
+
+
 namespace ngs {
 
 class RelicDrawer {
+  // インスタンスごとの情報
+  struct Instance {
+    // ワールド座標(高さは海面で補正する前)
+    ci::vec3 position;
+    // 探索の進み具合による色
+    ci::vec4 color;
+  };
+
+  enum {
+    // 未探索と探索済みでモデルが違う
+    MODEL_NUM = 2,
+
+    INITIAL_CAPACITY = 64,
+  };
+
   float range_;
-  
+
   std::vector<ci::Color> color_;
   ci::gl::GlslProgRef shader_;
 
-  ci::gl::VboMeshRef model_;
-  ci::gl::VboMeshRef model2_;
+  ci::gl::VboRef   instance_vbo_[MODEL_NUM];
+  ci::gl::BatchRef batch_[MODEL_NUM];
+
+  // 描画範囲内の遺物
+  std::vector<Instance> instances_[MODEL_NUM];
+  size_t capacity_[MODEL_NUM];
 
   ci::quat rotation_;
 
   ci::vec3 rotate_speed_;
-  
+
+
+  static ci::gl::BatchRef createBatch(const std::string& path,
+                                      const ci::gl::VboRef& instance_vbo,
+                                      const ci::gl::GlslProgRef& shader) {
+    auto mesh = CookedMesh::load(path);
+
+    // インスタンスごとに進める頂点属性
+    ci::geom::BufferLayout layout;
+    layout.append(ci::geom::Attrib::CUSTOM_0, 3, sizeof(Instance), offsetof(Instance, position), 1);
+    layout.append(ci::geom::Attrib::CUSTOM_1, 4, sizeof(Instance), offsetof(Instance, color), 1);
+    mesh->appendVbo(layout, instance_vbo);
+
+    return ci::gl::Batch::create(mesh, shader, {
+        { ci::geom::Attrib::CUSTOM_0, "InstancePosition" },
+        { ci::geom::Attrib::CUSTOM_1, "InstanceColor" },
+      });
+  }
+
+  // インスタンス情報をGPUへ転送
+  void uploadInstances(const size_t index) {
+    const auto& instances = instances_[index];
+    if (instances.empty()) return;
+
+    // TIPS:足りなくなったら倍々で確保し直す
+    //      バッファ自体は同じなので頂点属性の設定はそのまま使える
+    if (instances.size() > capacity_[index]) {
+      capacity_[index] = std::max(instances.size(), capacity_[index] * 2);
+    }
+
+    // 描画中のデータを待たないよう領域を捨ててから書き込む
+    auto& vbo = instance_vbo_[index];
+    vbo->bufferData(capacity_[index] * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+    vbo->bufferSubData(0, instances.size() * sizeof(Instance), &instances[0]);
+  }
+
 
 public:
   RelicDrawer(const ci::JsonTree& params)
@@ -27,61 +88,68 @@ public:
     for (size_t i = 0; i < params["color"].getNumChildren(); ++i) {
       color_.push_back(Json::getColor<float>(params["color"][i]));
     }
-    
+
     // 計算量を減らすため２乗した値を保存
     float range = params.getValueForKey<float>("range");
     range_ = range * range;
-    
-    shader_ = createShader("color", "color");
 
-    {
-      ci::ObjLoader loader(Asset::load("relic.obj"));
-      model_ = ci::gl::VboMesh::create(loader);
-    }
+    shader_ = createShader("instance", "color", { "INSTANCE_ROTATION" });
 
-    {
-      ci::ObjLoader loader(Asset::load("relic_get.obj"));
-      model2_ = ci::gl::VboMesh::create(loader);
+    const char* models[] = {
+      "relic.obj",
+      "relic_get.obj",
+    };
+
+    for (int i = 0; i < MODEL_NUM; ++i) {
+      capacity_[i] = INITIAL_CAPACITY;
+      instance_vbo_[i] = ci::gl::Vbo::create(GL_ARRAY_BUFFER, capacity_[i] * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+      batch_[i] = createBatch(models[i], instance_vbo_[i], shader_);
     }
   }
 
-  
-  void setupLight(const Light& light) {
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
-  }
 
-  
-  void update() {
+  // 見えている地形から描画範囲内の遺物を選び、インスタンス情報を作る
+  //   center 船の位置
+  void update(const std::vector<VisibleStage>& stages, const ci::vec3& center) {
     rotation_ = rotation_ * ci::quat(rotate_speed_);
+
+    for (auto& instances : instances_) {
+      instances.clear();
+    }
+
+    for (const auto& visible : stages) {
+      for (const auto& relic : *visible.relics) {
+        // 船からの距離によるクリッピング
+        float dx = relic.position.x + visible.offset.x - center.x;
+        float dz = relic.position.z + visible.offset.z - center.z;
+        if ((dx * dx + dz * dz) > range_) continue;
+
+        // 探索すると色が変わる
+        float t = std::min(relic.searched_time / relic.search_required_time, 1.0);
+        auto color = color_[0].lerp(t, color_[1]);
+
+        Instance instance = {
+          ci::vec3(relic.position) + visible.offset,
+          ci::vec4(color.r, color.g, color.b, 1.0f),
+        };
+        instances_[relic.searched ? 1 : 0].push_back(instance);
+      }
+    }
+
+    for (int i = 0; i < MODEL_NUM; ++i) {
+      uploadInstances(i);
+    }
   }
-  
-  void draw(const std::vector<Relic>& relics, const ci::vec3& offset, const ci::vec3& center, const float sea_level) {
-    if (relics.empty()) return;
-
-    ci::gl::ScopedGlslProg shader(shader_);
-
-    for (const auto& relic : relics) {
-      // 船からの距離によるクリッピング
-      float dx = relic.position.x - center.x;
-      float dz = relic.position.z - center.z;
-      if ((dx * dx + dz * dz) > range_) continue;
-      
-      ci::vec3 pos(relic.position.x, std::max(float(relic.position.y), sea_level), relic.position.z);
-      
-      // TIPS:マス目の中央に位置するようオフセットを加えている
-      ci::mat4 transform = glm::translate(pos + ci::vec3(0.5, 0.5, 0.5) + offset)
-        * glm::mat4_cast(rotation_);
-      ci::gl::setModelMatrix(transform);
-
-      // 探索すると色が変わる
-      float t = std::min(relic.searched_time / relic.search_required_time, 1.0);
-      auto color = color_[0].lerp(t, color_[1]);
-      ci::gl::color(color);
-
-      ci::gl::draw(relic.searched ? model2_
-                                  : model_);
+
+  void draw(RenderQueue& queue, const Light& light, const float sea_level) {
+    shader_->uniform("Rotation", glm::mat4_cast(rotation_));
+    shader_->uniform("SeaLevel", sea_level);
+
+    // TIPS:位置はインスタンス情報に含まれている
+    for (int i = 0; i < MODEL_NUM; ++i) {
+      if (instances_[i].empty()) continue;
+
+      queue.drawInstanced(nullptr, &light, batch_[i], instances_[i].size(), ci::mat4(1.0f));
     }
   }
 
@@ -0,0 +1,406 @@
+﻿#pragma once
+
+//
+// 描画命令のキュー
+//   描画物は命令を積むだけにして、並べ替えてからまとめて実行する
+//   シェーダー・テクスチャ・光源の切り替えを最小限にするのが目的
+//
+
+#include <cinder/gl/gl.h>
+#include <algorithm>
+#include <vector>
+#include "Light.hpp"
+#include "SharedUniforms.hpp"
+
+
+namespace ngs {
+
+// 描画命令
+struct RenderCommand {
+  // 並べ替え用のキー
+  //   シェーダー > 光源 > テクスチャ > メッシュ > 積んだ順
+  uint64_t key;
+
+  // TIPS:並べ替えと比較にしか使わないので生ポインタで持つ
+  //      実体は描画物が持っている
+  ci::gl::GlslProg*  shader;
+  ci::gl::Texture2d* texture;
+  const Light*       light;
+
+  // 通常の描画
+  ci::gl::VboMeshRef mesh;
+  // インデックスの範囲(count == 0 なら全体)
+  uint32_t first;
+  uint32_t count;
+
+  // インスタンス描画
+  //   instance_num == 0 の時はインデックスの範囲を描画
+  ci::gl::BatchRef batch;
+  uint32_t instance_num;
+
+  ci::mat4 transform;
+
+  // シェーダーで加える位置(TileOffset)
+  bool use_offset;
+  ci::vec3 offset;
+};
+
+
+// 実行時の統計
+struct RenderStats {
+  int shader_num    = 0;
+  int texture_num   = 0;
+  int light_num     = 0;
+  int transform_num = 0;
+  int offset_num    = 0;
+  int draw_num      = 0;
+
+  // 状態の切り替え回数
+  int getStateChangeNum() const {
+    return shader_num + texture_num + light_num + transform_num + offset_num;
+  }
+
+  RenderStats& operator+=(const RenderStats& rhs) {
+    shader_num    += rhs.shader_num;
+    texture_num   += rhs.texture_num;
+    light_num     += rhs.light_num;
+    transform_num += rhs.transform_num;
+    offset_num    += rhs.offset_num;
+    draw_num      += rhs.draw_num;
+    return *this;
+  }
+};
+
+
+// 実際の描画を担当する
+//   状態が変わった時だけ呼ばれる
+class RenderBackend {
+public:
+  virtual ~RenderBackend() = default;
+
+  virtual void begin() {}
+  virtual void end() {}
+
+  virtual void bindShader(ci::gl::GlslProg* shader) = 0;
+  virtual void bindTexture(ci::gl::Texture2d* texture) = 0;
+  virtual void setupLight(const Light& light) = 0;
+  virtual void setTransform(const ci::mat4& transform) = 0;
+  virtual void setOffset(ci::gl::GlslProg* shader, const ci::vec3& offset) = 0;
+  virtual void draw(const RenderCommand& command) = 0;
+};
+
+
+// OpenGLで描画する
+class GlRenderBackend : public RenderBackend {
+public:
+  void begin() override {
+    ci::gl::context()->pushGlslProg();
+  }
+
+  void end() override {
+    ci::gl::context()->popGlslProg();
+  }
+
+  void bindShader(ci::gl::GlslProg* shader) override {
+    shader->bind();
+  }
+
+  void bindTexture(ci::gl::Texture2d* texture) override {
+    texture->bind();
+  }
+
+  // 光源はuniformバッファの範囲を結び付けるだけ
+  void setupLight(const Light& light) override {
+    getSharedUniforms().bindLight(light);
+  }
+
+  void setTransform(const ci::mat4& transform) override {
+    ci::gl::setModelMatrix(transform);
+  }
+
+  void setOffset(ci::gl::GlslProg* shader, const ci::vec3& offset) override {
+    shader->uniform("TileOffset", offset);
+  }
+
+  void draw(const RenderCommand& command) override {
+    if (command.batch) {
+      if (command.instance_num > 0) {
+        command.batch->drawInstanced(command.instance_num);
+      }
+      else {
+        command.batch->draw(command.first, command.count);
+      }
+    }
+    else if (command.count > 0) {
+      ci::gl::draw(command.mesh, command.first, command.count);
+    }
+    else {
+      ci::gl::draw(command.mesh);
+    }
+  }
+};
+
+
+// 呼び出しを記録するだけ
+//   GPUが無くても状態の切り替え回数や描画回数を調べられる
+class RecordingBackend : public RenderBackend {
+public:
+  enum class Op {
+    BIND_SHADER,
+    BIND_TEXTURE,
+    SETUP_LIGHT,
+    SET_TRANSFORM,
+    SET_OFFSET,
+    DRAW,
+  };
+
+
+  void bindShader(ci::gl::GlslProg*) override {
+    ops_.push_back(Op::BIND_SHADER);
+  }
+
+  void bindTexture(ci::gl::Texture2d*) override {
+    ops_.push_back(Op::BIND_TEXTURE);
+  }
+
+  void setupLight(const Light&) override {
+    ops_.push_back(Op::SETUP_LIGHT);
+  }
+
+  void setTransform(const ci::mat4&) override {
+    ops_.push_back(Op::SET_TRANSFORM);
+  }
+
+  void setOffset(ci::gl::GlslProg*, const ci::vec3&) override {
+    ops_.push_back(Op::SET_OFFSET);
+  }
+
+  void draw(const RenderCommand&) override {
+    ops_.push_back(Op::DRAW);
+  }
+
+
+  const std::vector<Op>& getOps() const {
+    return ops_;
+  }
+
+  size_t count(const Op op) const {
+    return std::count(std::begin(ops_), std::end(ops_), op);
+  }
+
+  void clear() {
+    ops_.clear();
+  }
+
+
+private:
+  std::vector<Op> ops_;
+
+};
+
+
+class RenderQueue {
+  // キーのビット配分
+  enum {
+    SEQUENCE_BITS = 20,
+    MESH_BITS     = 16,
+    TEXTURE_BITS  = 12,
+    LIGHT_BITS    = 4,
+    SHADER_BITS   = 12,
+  };
+
+  std::vector<RenderCommand> commands_;
+  bool sorted_ = true;
+
+  // 資源ごとの通し番号(積んだ順)
+  std::vector<const void*> shaders_;
+  std::vector<const void*> lights_;
+  std::vector<const void*> textures_;
+  std::vector<const void*> meshes_;
+
+  // 実行中にシェーダーへ設定した位置
+  std::vector<std::pair<ci::gl::GlslProg*, ci::vec3>> applied_offsets_;
+
+
+  // 通し番号を取得(0は資源無し)
+  static uint64_t findId(std::vector<const void*>& ids, const void* ptr, const int bits) {
+    if (!ptr) return 0;
+
+    auto it = std::find(std::begin(ids), std::end(ids), ptr);
+    if (it == std::end(ids)) {
+      ids.push_back(ptr);
+      it = std::end(ids) - 1;
+    }
+
+    uint64_t id = std::distance(std::begin(ids), it) + 1;
+    return std::min(id, (uint64_t(1) << bits) - 1);
+  }
+
+
+public:
+  RenderQueue() = default;
+
+
+  // フレームの最初に呼ぶ
+  void clear() {
+    // TIPS:確保済みのメモリは使い回す
+    commands_.clear();
+    shaders_.clear();
+    lights_.clear();
+    textures_.clear();
+    meshes_.clear();
+    sorted_ = true;
+  }
+
+
+  // 命令をそのまま積む
+  //   mesh 並べ替えに使うメッシュやBatch
+  //   TIPS:keyはここで決める
+  void push(RenderCommand command, const void* mesh) {
+    uint64_t sequence = std::min(uint64_t(commands_.size()), (uint64_t(1) << SEQUENCE_BITS) - 1);
+
+    command.key = (findId(shaders_,  command.shader,  SHADER_BITS)  << (SEQUENCE_BITS + MESH_BITS + TEXTURE_BITS + LIGHT_BITS))
+                | (findId(lights_,   command.light,   LIGHT_BITS)   << (SEQUENCE_BITS + MESH_BITS + TEXTURE_BITS))
+                | (findId(textures_, command.texture, TEXTURE_BITS) << (SEQUENCE_BITS + MESH_BITS))
+                | (findId(meshes_,   mesh,            MESH_BITS)    << SEQUENCE_BITS)
+                | sequence;
+
+    commands_.push_back(std::move(command));
+    sorted_ = false;
+  }
+
+  // 通常の描画
+  //   count == 0 ならメッシュ全体を描画
+  void draw(ci::gl::GlslProg* shader, ci::gl::Texture2d* texture, const Light* light,
+            const ci::gl::VboMeshRef& mesh, const ci::mat4& transform,
+            const uint32_t first = 0, const uint32_t count = 0) {
+    RenderCommand command = {
+      0,
+      shader, texture, light,
+      mesh, first, count,
+      nullptr, 0,
+      transform,
+      false, ci::vec3(),
+    };
+    push(std::move(command), mesh.get());
+  }
+
+  // インスタンス描画
+  void drawInstanced(ci::gl::Texture2d* texture, const Light* light,
+                     const ci::gl::BatchRef& batch, const uint32_t instance_num,
+                     const ci::mat4& transform) {
+    RenderCommand command = {
+      0,
+      batch->getGlslProg().get(), texture, light,
+      nullptr, 0, 0,
+      batch, instance_num,
+      transform,
+      false, ci::vec3(),
+    };
+    push(std::move(command), batch.get());
+  }
+
+  // 共有バッファの一部を描画
+  //   位置はモデル行列ではなくシェーダーのTileOffsetで指定する
+  void drawRange(ci::gl::Texture2d* texture, const Light* light,
+                 const ci::gl::BatchRef& batch, const uint32_t first, const uint32_t count,
+                 const ci::vec3& offset) {
+    RenderCommand command = {
+      0,
+      batch->getGlslProg().get(), texture, light,
+      nullptr, first, count,
+      batch, 0,
+      ci::mat4(1.0f),
+      true, offset,
+    };
+    push(std::move(command), batch.get());
+  }
+
+
+  // 並べ替えて実行する
+  //   同じ命令を何度でも実行できる
+  RenderStats execute(RenderBackend& backend) {
+    if (!sorted_) {
+      std::sort(std::begin(commands_), std::end(commands_),
+                [](const RenderCommand& a, const RenderCommand& b) {
+                  return a.key < b.key;
+                });
+      sorted_ = true;
+    }
+
+    RenderStats stats;
+    if (commands_.empty()) return stats;
+
+    backend.begin();
+
+    ci::gl::GlslProg*  shader  = nullptr;
+    ci::gl::Texture2d* texture = nullptr;
+    const Light* light         = nullptr;
+    const ci::mat4* transform  = nullptr;
+    applied_offsets_.clear();
+
+    for (const auto& command : commands_) {
+      if (command.shader != shader) {
+        shader = command.shader;
+        backend.bindShader(shader);
+        stats.shader_num += 1;
+      }
+
+      // TIPS:光源は全てのシェーダーで共有しているので、シェーダーが変わっても設定し直さなくて良い
+      if (command.light && (command.light != light)) {
+        light = command.light;
+        backend.setupLight(*light);
+        stats.light_num += 1;
+      }
+
+      // テクスチャを使わない命令は直前の状態のままにしておく
+      if (command.texture && (command.texture != texture)) {
+        texture = command.texture;
+        backend.bindTexture(texture);
+        stats.texture_num += 1;
+      }
+
+      if (command.use_offset) {
+        auto it = std::find_if(std::begin(applied_offsets_), std::end(applied_offsets_),
+                               [shader](const std::pair<ci::gl::GlslProg*, ci::vec3>& applied) {
+                                 return applied.first == shader;
+                               });
+        if (it == std::end(applied_offsets_) || (it->second != command.offset)) {
+          if (it == std::end(applied_offsets_)) {
+            applied_offsets_.push_back(std::make_pair(shader, command.offset));
+          }
+          else {
+            it->second = command.offset;
+          }
+          backend.setOffset(shader, command.offset);
+          stats.offset_num += 1;
+        }
+      }
+
+      if (!transform || (*transform != command.transform)) {
+        transform = &command.transform;
+        backend.setTransform(command.transform);
+        stats.transform_num += 1;
+      }
+
+      backend.draw(command);
+      stats.draw_num += 1;
+    }
+
+    backend.end();
+
+    return stats;
+  }
+
+
+  size_t size() const {
+    return commands_.size();
+  }
+
+  bool empty() const {
+    return commands_.empty();
+  }
+
+};
+
+}
@@ -0,0 +1,133 @@
+﻿#pragma once
+
+//
+// 描画命令のキューの検証
+//   GPUを使わずに、並べ替えた順番と状態の切り替え回数を調べる
+//   DEBUGビルドの起動時に実行する
+//
+//   TIPS:資源は比較にしか使わないので、ダミーのアドレスを渡す
+//
+
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "Light.hpp"
+#include "RenderQueue.hpp"
+
+
+namespace ngs { namespace RenderQueueTest {
+
+// 描画した順番を記録する
+//   TIPS:命令のfirstに積んだ順番を入れておく
+class OrderBackend : public RecordingBackend {
+public:
+  std::vector<uint32_t> order;
+
+  void draw(const RenderCommand& command) override {
+    RecordingBackend::draw(command);
+    order.push_back(command.first);
+  }
+};
+
+
+void test() {
+  using Op = RecordingBackend::Op;
+
+  char dummy[8];
+  auto* shader_a  = reinterpret_cast<ci::gl::GlslProg*>(&dummy[0]);
+  auto* shader_b  = reinterpret_cast<ci::gl::GlslProg*>(&dummy[1]);
+  auto* shader_c  = reinterpret_cast<ci::gl::GlslProg*>(&dummy[2]);
+  auto* texture_a = reinterpret_cast<ci::gl::Texture2d*>(&dummy[3]);
+  auto* texture_b = reinterpret_cast<ci::gl::Texture2d*>(&dummy[4]);
+
+  // 所有しないshared_ptr
+  ci::gl::VboMeshRef mesh_a(std::shared_ptr<void>(), reinterpret_cast<ci::gl::VboMesh*>(&dummy[5]));
+  ci::gl::VboMeshRef mesh_b(std::shared_ptr<void>(), reinterpret_cast<ci::gl::VboMesh*>(&dummy[6]));
+  const void* range = &dummy[7];
+
+  Light light;
+  ci::mat4 transform_a(1.0f);
+  ci::mat4 transform_b = glm::translate(ci::vec3(1, 0, 0));
+
+  RenderQueue queue;
+
+  // 通常の描画(firstが積んだ順番)
+  queue.draw(shader_b, texture_a, &light, mesh_a, transform_a, 0, 1);
+  queue.draw(shader_a, texture_b, &light, mesh_a, transform_a, 1, 1);
+  queue.draw(shader_a, texture_a, &light, mesh_b, transform_a, 2, 1);
+  // テクスチャを使わない
+  queue.draw(shader_b, nullptr,   &light, mesh_b, transform_a, 3, 1);
+  queue.draw(shader_a, texture_a, &light, mesh_a, transform_a, 4, 1);
+  queue.draw(shader_c, nullptr,   &light, mesh_a, transform_a, 5, 1);
+  // 直前のシェーダーで結び付けたテクスチャと同じ
+  queue.draw(shader_c, texture_b, &light, mesh_a, transform_a, 6, 1);
+
+  // TileOffsetで位置を指定する描画
+  auto pushRange = [&](const uint32_t first, const ci::vec3& offset, const ci::mat4& transform) {
+    RenderCommand command = {
+      0,
+      shader_c, texture_b, &light,
+      nullptr, first, 1,
+      nullptr, 0,
+      transform,
+      true, offset,
+    };
+    queue.push(command, range);
+  };
+  pushRange(7, ci::vec3(1, 0, 0), transform_a);
+  // 同じ位置
+  pushRange(8, ci::vec3(1, 0, 0), transform_a);
+  pushRange(9, ci::vec3(2, 0, 0), transform_b);
+
+  assert(queue.size() == 10);
+
+  // シェーダー > 光源 > テクスチャ(無しが先) > メッシュ > 積んだ順
+  const std::vector<uint32_t> expected_order = { 3, 0, 4, 2, 1, 5, 6, 7, 8, 9 };
+  const std::vector<Op> expected_ops = {
+    Op::BIND_SHADER, Op::SETUP_LIGHT, Op::SET_TRANSFORM, Op::DRAW,
+    Op::BIND_TEXTURE, Op::DRAW,
+    Op::BIND_SHADER, Op::DRAW,
+    Op::DRAW,
+    Op::BIND_TEXTURE, Op::DRAW,
+    Op::BIND_SHADER, Op::DRAW,
+    Op::DRAW,
+    Op::SET_OFFSET, Op::DRAW,
+    Op::DRAW,
+    Op::SET_OFFSET, Op::SET_TRANSFORM, Op::DRAW,
+  };
+
+  // 同じ命令は何度実行しても同じ結果になる
+  for (int i = 0; i < 2; ++i) {
+    OrderBackend backend;
+    auto stats = queue.execute(backend);
+
+    assert(backend.order == expected_order);
+    assert(backend.getOps() == expected_ops);
+
+    assert(stats.shader_num    == 3);
+    assert(stats.light_num     == 1);
+    assert(stats.texture_num   == 2);
+    assert(stats.transform_num == 2);
+    assert(stats.offset_num    == 2);
+    assert(stats.draw_num      == 10);
+    assert(stats.getStateChangeNum() == 10);
+
+    assert(backend.count(Op::BIND_SHADER)   == size_t(stats.shader_num));
+    assert(backend.count(Op::SETUP_LIGHT)   == size_t(stats.light_num));
+    assert(backend.count(Op::BIND_TEXTURE)  == size_t(stats.texture_num));
+    assert(backend.count(Op::SET_TRANSFORM) == size_t(stats.transform_num));
+    assert(backend.count(Op::SET_OFFSET)    == size_t(stats.offset_num));
+    assert(backend.count(Op::DRAW)          == size_t(stats.draw_num));
+  }
+
+  // 空のキューは何もしない
+  queue.clear();
+  RecordingBackend backend;
+  auto stats = queue.execute(backend);
+  assert(backend.getOps().empty());
+  assert(stats.draw_num == 0);
+
+  DOUT << "RenderQueueTest: done" << std::endl;
+}
+
+} }
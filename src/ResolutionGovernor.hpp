@@ -0,0 +1,157 @@
+﻿#pragma once
+
+//
+// オフスクリーン描画の解像度調整
+//   フレーム時間を計測し、目標に届かなければ解像度を下げ、
+//   余裕があれば上げる
+//
+
+#include <cinder/gl/Fbo.h>
+#include <cinder/Json.h>
+#include <cmath>
+#include <vector>
+#include "JsonUtil.hpp"
+
+
+namespace ngs {
+
+class ResolutionGovernor {
+  // 段階ごとの大きさ(小さい順)
+  std::vector<ci::ivec2> levels_;
+  // 段階ごとのFBO(一度作ったら使い回す)
+  std::vector<ci::gl::FboRef> pool_;
+
+  size_t level_;
+  // 画面の大きさで制限された上限
+  size_t max_level_;
+
+  // 目標とするフレーム時間(秒)
+  double target_time_;
+
+  // 解像度を変えるまでに必要な連続フレーム数
+  int down_frames_;
+  int up_frames_;
+  int slow_count_ = 0;
+  int fast_count_ = 0;
+  // 上げた直後に下がった時は、次に上げるまでの期間を延ばす
+  int up_backoff_ = 1;
+  bool raised_    = false;
+
+  double last_time_    = -1.0;
+  double average_time_ = 0.0;
+
+
+  // 16の倍数に丸める
+  static int alignSize(const double size) {
+    return std::max(int(size / 16.0 + 0.5) * 16, 16);
+  }
+
+
+public:
+  ResolutionGovernor(const ci::JsonTree& params)
+    : target_time_(1.0 / params.getValueForKey<double>("target_fps")),
+      down_frames_(params.getValueForKey<int>("down_frames")),
+      up_frames_(params.getValueForKey<int>("up_frames"))
+  {
+    auto min_size = Json::getVec<ci::vec2>(params["min"]);
+    auto max_size = Json::getVec<ci::vec2>(params["max"]);
+    int num = std::max(params.getValueForKey<int>("levels"), 2);
+
+    // 面積が一定の割合で変わるよう等比で分割
+    for (int i = 0; i < num; ++i) {
+      double t = double(i) / (num - 1);
+      levels_.push_back(ci::ivec2(alignSize(min_size.x * std::pow(max_size.x / min_size.x, t)),
+                                  alignSize(min_size.y * std::pow(max_size.y / min_size.y, t))));
+    }
+    pool_.resize(levels_.size());
+
+    // 初期値に一番近い段階から始める
+    ci::vec2 initial(params.getValueForKey<float>("width"), params.getValueForKey<float>("height"));
+    level_ = 0;
+    for (size_t i = 1; i < levels_.size(); ++i) {
+      if (glm::distance(ci::vec2(levels_[i]), initial) < glm::distance(ci::vec2(levels_[level_]), initial)) {
+        level_ = i;
+      }
+    }
+    max_level_ = levels_.size() - 1;
+  }
+
+
+  // 毎フレーム呼ぶ
+  //   current_time 経過時間(秒)
+  //   window_size  画面の大きさ(縦横どちらもこれを超えない段階までに制限する)
+  //   TIPS:一番小さい段階は画面より大きくても使う
+  void update(const double current_time, const ci::ivec2& window_size) {
+    max_level_ = 0;
+    for (size_t i = 1; i < levels_.size(); ++i) {
+      if (levels_[i].x > window_size.x || levels_[i].y > window_size.y) break;
+      max_level_ = i;
+    }
+    level_ = std::min(level_, max_level_);
+
+    if (last_time_ < 0.0) {
+      last_time_ = current_time;
+      return;
+    }
+
+    double frame_time = current_time - last_time_;
+    last_time_ = current_time;
+
+    // TIPS:単発の引っかかりでは変えないよう平滑化する
+    average_time_ = (average_time_ == 0.0) ? frame_time
+                                           : average_time_ * 0.9 + frame_time * 0.1;
+
+    if (average_time_ > (target_time_ * 1.1)) {
+      slow_count_ += 1;
+      fast_count_  = 0;
+    }
+    else if (average_time_ < (target_time_ * 1.02)) {
+      fast_count_ += 1;
+      slow_count_  = 0;
+    }
+    else {
+      slow_count_ = 0;
+      fast_count_ = 0;
+    }
+
+    if (slow_count_ >= down_frames_ && level_ > 0) {
+      level_ -= 1;
+      if (raised_) {
+        up_backoff_ = std::min(up_backoff_ * 2, 16);
+      }
+      raised_     = false;
+      slow_count_ = 0;
+      fast_count_ = 0;
+    }
+    else if (fast_count_ >= (up_frames_ * up_backoff_) && level_ < max_level_) {
+      level_ += 1;
+      raised_     = true;
+      slow_count_ = 0;
+      fast_count_ = 0;
+    }
+  }
+
+
+  const ci::gl::FboRef& getFbo() {
+    auto& fbo = pool_[level_];
+    if (!fbo) {
+      auto format = ci::gl::Fbo::Format()
+        .colorTexture()
+        ;
+      fbo = ci::gl::Fbo::create(levels_[level_].x, levels_[level_].y, format);
+    }
+    return fbo;
+  }
+
+  const ci::ivec2& getSize() const {
+    return levels_[level_];
+  }
+
+  // 平滑化したフレーム時間(秒)
+  double getFrameTime() const {
+    return average_time_;
+  }
+
+};
+
+}
@@ -2,53 +2,93 @@
 
 //
 // 経路描画
+//   経路が決まった時にインスタンス情報を転送し、まとめて描画する
 //
 
+#include <cstddef>
+#include "CookedMesh.hpp"
+#include "RenderQueue.hpp"
+
+
 namespace ngs {
 
 class RouteDrawer {
+  // インスタンスごとの情報(instance.vshと合わせる)
+  struct Instance {
+    ci::vec3 position;
+    ci::vec4 color;
+  };
+
   ci::Color color_;
   
   ci::gl::GlslProgRef shader_;
-  ci::gl::VboMeshRef model_;
 
-  
-  void setupLight(const Light& light) {
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
-  }
+  ci::gl::VboRef   instance_vbo_;
+  ci::gl::BatchRef batch_;
+
+  // 確保済みのインスタンス数
+  size_t capacity_ = 0;
+  // 描画するインスタンス数
+  size_t instance_num_ = 0;
 
   
 public:
   RouteDrawer(const ci::JsonTree& params)
     : color_(Json::getColor<float>(params["color"]))
   {
-    shader_ = createShader("color", "color");
+    shader_ = createShader("instance", "color");
+
+    auto model = CookedMesh::load("route.obj");
+
+    instance_vbo_ = ci::gl::Vbo::create(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+
+    ci::geom::BufferLayout layout;
+    layout.append(ci::geom::Attrib::CUSTOM_0, 3, sizeof(Instance), offsetof(Instance, position), 1);
+    layout.append(ci::geom::Attrib::CUSTOM_1, 4, sizeof(Instance), offsetof(Instance, color), 1);
+    model->appendVbo(layout, instance_vbo_);
 
-    ci::ObjLoader loader(Asset::load("route.obj"));
-    model_ = ci::gl::VboMesh::create(loader);
+    batch_ = ci::gl::Batch::create(model, shader_, {
+        { ci::geom::Attrib::CUSTOM_0, "InstancePosition" },
+        { ci::geom::Attrib::CUSTOM_1, "InstanceColor" },
+      });
   }
-             
 
-  void draw(const std::vector<Waypoint>& route, const Light& light, const float sea_level) {
-    if (route.empty()) return;
-    
-    setupLight(light);
 
-    ci::gl::ScopedGlslProg shader(shader_);
-    ci::gl::color(color_);
+  // 経路が変わった時に呼ぶ
+  //   TIPS:海面による高さの補正はシェーダーで行うので、経路が変わらない限り転送は不要
+  void setRoute(const std::vector<Waypoint>& route) {
+    // 終点は目的地の表示と重なるので描画しない
+    instance_num_ = route.empty() ? 0 : route.size() - 1;
+    if (instance_num_ == 0) return;
 
-    for (size_t i = 0; i < route.size() - 1; ++i) {
-      const auto& waypoint = route[i];
-      ci::vec3 pos(waypoint.pos.x, std::max(sea_level, float(waypoint.pos.y)), waypoint.pos.z);
+    std::vector<Instance> instances;
+    instances.reserve(instance_num_);
+    for (size_t i = 0; i < instance_num_; ++i) {
+      Instance instance = {
+        route[i].pos,
+        ci::vec4(color_.r, color_.g, color_.b, 1.0f),
+      };
+      instances.push_back(instance);
+    }
 
-      // TIPS:マス目の中央に位置するようオフセットを加えている
-      ci::mat4 transform = glm::translate(pos + ci::vec3(0.5, 0.5, 0.5));
-      ci::gl::setModelMatrix(transform);
-      
-      ci::gl::draw(model_);
+    size_t size = instance_num_ * sizeof(Instance);
+    if (instance_num_ > capacity_) {
+      capacity_ = instance_num_;
+      instance_vbo_->bufferData(size, &instances[0], GL_STATIC_DRAW);
     }
+    else {
+      instance_vbo_->bufferSubData(0, size, &instances[0]);
+    }
+  }
+  
+
+  void draw(RenderQueue& queue, const Light& light, const float sea_level) {
+    if (instance_num_ == 0) return;
+    
+    shader_->uniform("SeaLevel", sea_level);
+
+    // TIPS:位置はインスタンス情報に含まれている
+    queue.drawInstanced(nullptr, &light, batch_, instance_num_, ci::mat4(1.0f));
   }
     
 };
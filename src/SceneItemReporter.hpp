@@ -72,18 +72,19 @@ class SceneItemReporter
   
 public:
   SceneItemReporter(Event& event,
+                    ItemModel& item_model,
                     const ci::JsonTree& params,
                     const ci::TimelineRef& timeline,
                     const ci::gl::FboRef& fbo,
                     const int index, const bool new_item)
     : event_(event),
       fbo_(fbo),
-      item_reporter_(event, params["item_reporter"], timeline)
+      item_reporter_(event, item_model, params["item_reporter"], timeline)
   {
     item_reporter_.loadItem(params["item.body"][index], new_item);
 
-    shader_ = createShader("bg", "bg");
-    model_  = ci::gl::VboMesh::create(ci::ObjLoader(Asset::load("bg.obj")));
+    shader_ = item_model.getBgShader();
+    model_  = item_model.get("bg.obj").mesh;
     
     holder_ += event_.connect("close_item_reporter",
                               [this](const Arguments&) {
@@ -0,0 +1,215 @@
+﻿#pragma once
+
+//
+// 全てのシェーダーで共有するuniform
+//   カメラの行列と光源をuniformバッファに置き、フレームの最初に一度だけ書き込む
+//   描画物ごとの切り替えは、バッファの範囲を結び付け直すだけで済む
+//
+
+#include <cinder/Camera.h>
+#include <cinder/gl/GlslProg.h>
+#include <cinder/gl/Vbo.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "Light.hpp"
+
+
+namespace ngs {
+
+class SharedUniforms {
+public:
+  // uniformブロックの結び付け先
+  enum {
+    CAMERA_BINDING = 0,
+    LIGHT_BINDING  = 1,
+
+    BINDING_NUM
+  };
+
+
+private:
+  enum {
+    // 最初に確保する領域の数(足りなければ倍々で増やす)
+    INITIAL_SLOT_NUM = 8,
+  };
+
+  // TIPS:シェーダー側はstd140なので、vec4とmat4だけで並べる
+  struct CameraBlock {
+    ci::mat4 view;
+    ci::mat4 projection;
+    ci::mat4 view_projection;
+  };
+
+  struct LightBlock {
+    ci::vec4 position;
+    ci::vec4 ambient;
+    ci::vec4 diffuse;
+  };
+
+  // 領域ごとの持ち主(nullptrは空き)
+  std::vector<const void*> owners_;
+  // 領域の間隔(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENTの倍数)
+  size_t stride_;
+
+  std::vector<uint8_t> data_;
+  ci::gl::VboRef ubo_;
+
+  // 転送が必要な領域の範囲
+  size_t dirty_begin_;
+  size_t dirty_end_ = 0;
+
+  // 結び付けている持ち主
+  const void* bound_[BINDING_NUM] = {};
+
+
+  size_t findSlot(const void* owner) {
+    auto it = std::find(std::begin(owners_), std::end(owners_), owner);
+    if (it != std::end(owners_)) return std::distance(std::begin(owners_), it);
+
+    // 空きを使う
+    it = std::find(std::begin(owners_), std::end(owners_), nullptr);
+    if (it != std::end(owners_)) {
+      *it = owner;
+      return std::distance(std::begin(owners_), it);
+    }
+
+    // バッファを作り直すので、全て結び付け直す
+    size_t slot = owners_.size();
+    owners_.resize(owners_.size() * 2, nullptr);
+    owners_[slot] = owner;
+
+    data_.resize(owners_.size() * stride_);
+    ubo_ = ci::gl::Vbo::create(GL_UNIFORM_BUFFER, data_.size(), nullptr, GL_DYNAMIC_DRAW);
+    dirty_begin_ = 0;
+    dirty_end_   = slot;
+    for (auto& bound : bound_) {
+      bound = nullptr;
+    }
+
+    return slot;
+  }
+
+  void write(const size_t slot, const void* block, const size_t size) {
+    std::memcpy(&data_[slot * stride_], block, size);
+
+    if (dirty_end_ == 0) {
+      dirty_begin_ = slot;
+      dirty_end_   = slot + 1;
+    }
+    else {
+      dirty_begin_ = std::min(dirty_begin_, slot);
+      dirty_end_   = std::max(dirty_end_, slot + 1);
+    }
+  }
+
+  // 書き換えた範囲をまとめて転送
+  void upload() {
+    if (dirty_end_ == 0) return;
+
+    ubo_->bufferSubData(dirty_begin_ * stride_, (dirty_end_ - dirty_begin_) * stride_, &data_[dirty_begin_ * stride_]);
+    dirty_end_ = 0;
+  }
+
+  void bind(const int binding, const void* owner, const size_t size) {
+    upload();
+    if (bound_[binding] == owner) return;
+
+    size_t slot = findSlot(owner);
+    upload();
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ubo_->getId(), slot * stride_, size);
+    bound_[binding] = owner;
+  }
+
+
+public:
+  SharedUniforms()
+    : owners_(INITIAL_SLOT_NUM, nullptr)
+  {
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 16);
+
+    size_t size = std::max(sizeof(CameraBlock), sizeof(LightBlock));
+    stride_ = ((size + alignment - 1) / alignment) * alignment;
+
+    data_.resize(owners_.size() * stride_);
+    ubo_ = ci::gl::Vbo::create(GL_UNIFORM_BUFFER, data_.size(), nullptr, GL_DYNAMIC_DRAW);
+  }
+
+
+  // シェーダーのuniformブロックを結び付け先に割り当てる
+  //   ブロックを使っていないシェーダーでは何もしない
+  static void setupBlocks(const ci::gl::GlslProgRef& shader) {
+    const std::pair<const char*, GLuint> blocks[] = {
+      { "Camera", CAMERA_BINDING },
+      { "Light",  LIGHT_BINDING },
+    };
+
+    GLuint handle = shader->getHandle();
+    for (const auto& block : blocks) {
+      GLuint index = glGetUniformBlockIndex(handle, block.first);
+      if (index == GL_INVALID_INDEX) continue;
+
+      glUniformBlockBinding(handle, index, block.second);
+    }
+  }
+
+
+  // 内容を更新する(転送は次に結び付ける時)
+  //   owner 結び付ける時に指定する持ち主
+  void setCamera(const void* owner, const ci::Camera& camera) {
+    CameraBlock block = {
+      camera.getViewMatrix(),
+      camera.getProjectionMatrix(),
+      camera.getProjectionMatrix() * camera.getViewMatrix(),
+    };
+    write(findSlot(owner), &block, sizeof(block));
+  }
+
+  void setLight(const Light& light) {
+    LightBlock block = {
+      light.direction,
+      ci::vec4(light.ambient.r, light.ambient.g, light.ambient.b, light.ambient.a),
+      ci::vec4(light.diffuse.r, light.diffuse.g, light.diffuse.b, light.diffuse.a),
+    };
+    write(findSlot(&light), &block, sizeof(block));
+  }
+
+
+  void bindCamera(const void* owner) {
+    bind(CAMERA_BINDING, owner, sizeof(CameraBlock));
+  }
+
+  void bindLight(const Light& light) {
+    if (std::find(std::begin(owners_), std::end(owners_), &light) == std::end(owners_)) {
+      // 初めて使う光源
+      setLight(light);
+    }
+    bind(LIGHT_BINDING, &light, sizeof(LightBlock));
+  }
+
+
+  // 持ち主が破棄される時に呼ぶ
+  void release(const void* owner) {
+    auto it = std::find(std::begin(owners_), std::end(owners_), owner);
+    if (it == std::end(owners_)) return;
+
+    *it = nullptr;
+    for (auto& bound : bound_) {
+      if (bound == owner) bound = nullptr;
+    }
+  }
+
+};
+
+
+// アプリ全体で一つだけ
+//   TIPS:GLのコンテキストが必要なので、最初に使う時に生成する
+SharedUniforms& getSharedUniforms() {
+  static SharedUniforms uniforms;
+  return uniforms;
+}
+
+}
@@ -4,13 +4,13 @@
 // 大海原を旅する船
 //
 
-#include <cinder/ObjLoader.h>
 #include "Arguments.hpp"
 #include "Event.hpp"
 #include "JsonUtil.hpp"
 #include "Light.hpp"
+#include "RenderQueue.hpp"
 #include "Waypoint.hpp"
-#include "PLY.hpp"
+#include "CookedMesh.hpp"
 
 
 namespace ngs {
@@ -96,7 +96,7 @@ public:
       do_route_(false)
   {
     shader_ = createShader("color", "color");
-    model_  = ci::gl::VboMesh::create(PLY::load("ship.ply"));
+    model_  = CookedMesh::load("ship.ply");
   }
 
 
@@ -159,11 +159,7 @@ public:
     }
   }
 
-  void draw(const Light& light) {
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
-    
+  void draw(RenderQueue& queue, const Light& light) {
     // TIPS:マス目の中央に位置するようオフセットを加えている
     ci::mat4 transform = glm::translate(position_ + ci::vec3(0.5, 0, 0.5))
                        * glm::mat4_cast(rotation_)
@@ -171,10 +167,7 @@ public:
                        * glm::scale(scaling_)
                        * glm::translate(offset_);
 
-    ci::gl::setModelMatrix(transform);
-    
-    ci::gl::ScopedGlslProg shader(shader_);
-    ci::gl::draw(model_);
+    queue.draw(shader_.get(), nullptr, &light, model_, transform);
   }
 
 };
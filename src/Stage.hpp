@@ -14,12 +14,34 @@
 #include <cinder/Rand.h>
 #include "StageObj.hpp"
 #include "StageObjFactory.hpp"
+#include "RayTriangle.hpp"
 #include <glm/gtc/noise.hpp>
 
 
 namespace ngs {
 
 class Stage {
+public:
+  // 地形の高さの範囲
+  // TIPS:地形を生成しなくても描画範囲の判定に使える
+  enum {
+    HEIGHT_MIN = 0,
+    HEIGHT_MAX = 16,
+
+    // 描画範囲を判定する小区画の大きさ
+    CHUNK_SIZE = 16,
+  };
+
+  // 小区画
+  //   land_のインデックス範囲とAABB
+  struct Chunk {
+    ci::AxisAlignedBox aabb;
+    uint32_t index_offset;
+    uint32_t index_num;
+  };
+
+
+private:
   ci::ivec2 size_;
 
   std::vector<std::vector<int>> height_map_;
@@ -27,15 +49,25 @@ class Stage {
   ci::TriMesh land_;
   ci::AxisAlignedBox aabb_;
 
+  std::vector<Chunk> chunks_;
+
+  // 交差判定用の三角形
+  // TIPS:クリックされた時に初めて生成する
+  mutable RayTriangle::Triangles triangles_;
+
   std::vector<StageObj> stage_objects_;
 
 
+  // TIPS:破棄した地形を作り直しても同じ配置になるよう、位置から乱数を初期化する
   void createStageObjects(const int width, const int deep,
+                          const int offset_x, const int offset_z,
                           const StageObjFactory& factory) {
+    ci::Rand rand(uint32_t(offset_x * 73856093) ^ uint32_t(offset_z * 19349663));
+
     for (int z = 0; z < deep; ++z) {
       for (int x = 0; x < width; ++x) {
         int y = height_map_[z][x];
-        auto stageobj = factory.create(y);
+        auto stageobj = factory.create(y, rand);
         if (!stageobj.first) continue;
 
         stage_objects_.emplace_back(stageobj.second, ci::vec3(x + 0.5f, y, z + 0.5f), ci::vec3(0), ci::vec3(1.0f / 16.0f));
@@ -68,7 +100,7 @@ public:
         float height = random.fBm(ofs);
         float scale  = (glm::simplex(ofs * random_scale.y) + 1.0f) * random_scale.z;
         
-        height_map_[z + 1][x + 1] = glm::clamp(height * scale + 2.0f, 0.0f, 16.0f);
+        height_map_[z + 1][x + 1] = glm::clamp(height * scale + 2.0f, float(HEIGHT_MIN), float(HEIGHT_MAX));
       }
     }
 
@@ -76,314 +108,341 @@ public:
     // 隣のブロックの高さを調べ、自分より低ければその分壁を作る作戦
     // TODO:コピペ感をなくす
     uint32_t index = 0;
-    for (int z = 0; z < deep; ++z) {
-      for (int x = 0; x < width; ++x) {
-        float y = height_map_[z + 1][x + 1];
+    // TIPS:CHUNK_SIZE四方の小区画ごとにまとめて生成し、
+    //      小区画ごとのインデックスの範囲で描画できるようにしている
+    for (int chunk_z = 0; chunk_z < deep; chunk_z += CHUNK_SIZE) {
+      for (int chunk_x = 0; chunk_x < width; chunk_x += CHUNK_SIZE) {
+        size_t vertex_offset = land_.getNumVertices();
+        size_t index_offset  = land_.getNumIndices();
+
+        for (int z = chunk_z; z < std::min(chunk_z + int(CHUNK_SIZE), deep); ++z) {
+          for (int x = chunk_x; x < std::min(chunk_x + int(CHUNK_SIZE), width); ++x) {
+            float y = height_map_[z + 1][x + 1];
         
-        {
-          // 上面
-          ci::vec3 p[] = {
-            {     x, y, z },
-            { x + 1, y, z },
-            {     x, y, z + 1 },
-            { x + 1, y, z + 1 },
-          };
-
-          // ４方向で高い場所がある場合法線が短くなる
-          float n0 = 1.0;
-          float n1 = 1.0;
-          float n2 = 1.0;
-          float n3 = 1.0;
-
-          if (height_map_[z + 1 - 1][x + 1] > y) {
-            n0 *= 0.75;
-            n1 *= 0.75;
-          }
-          if (height_map_[z + 1 + 1][x + 1] > y) {
-            n2 *= 0.75;
-            n3 *= 0.75;
-          }
-          if (height_map_[z + 1][x + 1 - 1] > y) {
-            n0 *= 0.75;
-            n2 *= 0.75;
-          }
-          if (height_map_[z + 1][x + 1 + 1] > y) {
-            n1 *= 0.75;
-            n3 *= 0.75;
-          }
-
-          if (height_map_[z + 1 - 1][x + 1 - 1] > y) {
-            n0 *= 0.75;
-          }
-          if (height_map_[z + 1 + 1][x + 1 - 1] > y) {
-            n2 *= 0.75;
-          }
-          if (height_map_[z + 1 - 1][x + 1 + 1] > y) {
-            n1 *= 0.75;
-          }
-          if (height_map_[z + 1 + 1][x + 1 + 1] > y) {
-            n3 *= 0.75;
-          }
+            {
+              // 上面
+              ci::vec3 p[] = {
+                {     x, y, z },
+                { x + 1, y, z },
+                {     x, y, z + 1 },
+                { x + 1, y, z + 1 },
+              };
+
+              // ４方向で高い場所がある場合法線が短くなる
+              float n0 = 1.0;
+              float n1 = 1.0;
+              float n2 = 1.0;
+              float n3 = 1.0;
+
+              if (height_map_[z + 1 - 1][x + 1] > y) {
+                n0 *= 0.75;
+                n1 *= 0.75;
+              }
+              if (height_map_[z + 1 + 1][x + 1] > y) {
+                n2 *= 0.75;
+                n3 *= 0.75;
+              }
+              if (height_map_[z + 1][x + 1 - 1] > y) {
+                n0 *= 0.75;
+                n2 *= 0.75;
+              }
+              if (height_map_[z + 1][x + 1 + 1] > y) {
+                n1 *= 0.75;
+                n3 *= 0.75;
+              }
+
+              if (height_map_[z + 1 - 1][x + 1 - 1] > y) {
+                n0 *= 0.75;
+              }
+              if (height_map_[z + 1 + 1][x + 1 - 1] > y) {
+                n2 *= 0.75;
+              }
+              if (height_map_[z + 1 - 1][x + 1 + 1] > y) {
+                n1 *= 0.75;
+              }
+              if (height_map_[z + 1 + 1][x + 1 + 1] > y) {
+                n3 *= 0.75;
+              }
           
           
-          ci::vec3 n[] = {
-            { 0, n0, 0 },
-            { 0, n1, 0 },
-            { 0, n2, 0 },
-            { 0, n3, 0 },
-          };
+              ci::vec3 n[] = {
+                { 0, n0, 0 },
+                { 0, n1, 0 },
+                { 0, n2, 0 },
+                { 0, n3, 0 },
+              };
           
-          ci::vec2 uv[] = {
-            { 0, p[0].y / 16.0f },
-            { 0, p[1].y / 16.0f },
-            { 0, p[2].y / 16.0f },
-            { 0, p[3].y / 16.0f },
-          };
+              ci::vec2 uv[] = {
+                { 0, p[0].y / 16.0f },
+                { 0, p[1].y / 16.0f },
+                { 0, p[2].y / 16.0f },
+                { 0, p[3].y / 16.0f },
+              };
         
-          land_.appendPositions(&p[0], 4);
-          land_.appendNormals(&n[0], 4);
-          land_.appendTexCoords0(&uv[0], 4);
+              land_.appendPositions(&p[0], 4);
+              land_.appendNormals(&n[0], 4);
+              land_.appendTexCoords0(&uv[0], 4);
         
-          land_.appendTriangle(index + 0, index + 2, index + 1);
-          land_.appendTriangle(index + 1, index + 2, index + 3);
-          index += 4;
-        }
+              land_.appendTriangle(index + 0, index + 2, index + 1);
+              land_.appendTriangle(index + 1, index + 2, index + 3);
+              index += 4;
+            }
 
-        if ((height_map_[z - 1 + 1][x + 1] < y)) {
-          // 側面(z-)
-          int dy = y - height_map_[z - 1 + 1][x + 1];
-          int xl_h = height_map_[z - 1 + 1][x + 1 - 1];
-          int xr_h = height_map_[z - 1 + 1][x + 1 + 1];
+            if ((height_map_[z - 1 + 1][x + 1] < y)) {
+              // 側面(z-)
+              int dy = y - height_map_[z - 1 + 1][x + 1];
+              int xl_h = height_map_[z - 1 + 1][x + 1 - 1];
+              int xr_h = height_map_[z - 1 + 1][x + 1 + 1];
           
-          for (int h = 0; h < dy; ++h) {
-            ci::vec3 p[] = {
-              {     x,     y - h, z },
-              { x + 1,     y - h, z },
-              {     x, y - 1 - h, z },
-              { x + 1, y - 1 - h, z },
-            };
-
-            float n0 = -1.0;
-            float n1 = -1.0;
-            float n2 = -1.0;
-            float n3 = -1.0;
-            if (h == (dy - 1)) {
-              n2 *= 0.6;
-              n3 *= 0.6;
-            }
-            if (xl_h >= (y - h)) {
-              n0 *= 0.6;
-            }
-            if (xr_h >= (y - h)) {
-              n1 *= 0.6;
-            }
-            if (xl_h >= (y - h - 1)) {
-              n2 *= 0.6;
-            }
-            if (xr_h >= (y - h - 1)) {
-              n3 *= 0.6;
-            }
+              for (int h = 0; h < dy; ++h) {
+                ci::vec3 p[] = {
+                  {     x,     y - h, z },
+                  { x + 1,     y - h, z },
+                  {     x, y - 1 - h, z },
+                  { x + 1, y - 1 - h, z },
+                };
+
+                float n0 = -1.0;
+                float n1 = -1.0;
+                float n2 = -1.0;
+                float n3 = -1.0;
+                if (h == (dy - 1)) {
+                  n2 *= 0.6;
+                  n3 *= 0.6;
+                }
+                if (xl_h >= (y - h)) {
+                  n0 *= 0.6;
+                }
+                if (xr_h >= (y - h)) {
+                  n1 *= 0.6;
+                }
+                if (xl_h >= (y - h - 1)) {
+                  n2 *= 0.6;
+                }
+                if (xr_h >= (y - h - 1)) {
+                  n3 *= 0.6;
+                }
             
-            ci::vec3 n[] = {
-              { 0, 0, n0 },
-              { 0, 0, n1 },
-              { 0, 0, n2 },
-              { 0, 0, n3 },
-            };
-
-            ci::vec2 uv[] = {
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-            };
+                ci::vec3 n[] = {
+                  { 0, 0, n0 },
+                  { 0, 0, n1 },
+                  { 0, 0, n2 },
+                  { 0, 0, n3 },
+                };
+
+                ci::vec2 uv[] = {
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                };
           
-            land_.appendPositions(&p[0], 4);
-            land_.appendNormals(&n[0], 4);
-            land_.appendTexCoords0(&uv[0], 4);
+                land_.appendPositions(&p[0], 4);
+                land_.appendNormals(&n[0], 4);
+                land_.appendTexCoords0(&uv[0], 4);
         
-            land_.appendTriangle(index + 0, index + 1, index + 2);
-            land_.appendTriangle(index + 1, index + 3, index + 2);
-            index += 4;
-          }
-        }
-        
-        if ((height_map_[z + 1 + 1][x + 1] < y)) {
-          // 側面(z+)
-          int dy = y - height_map_[z + 1 + 1][x + 1];
-          int xl_h = height_map_[z + 1 + 1][x + 1 - 1];
-          int xr_h = height_map_[z + 1 + 1][x + 1 + 1];
-
-          for (int h = 0; h < dy; ++h) {
-            ci::vec3 p[] = {
-              {     x,     y - h, z + 1 },
-              { x + 1,     y - h, z + 1 },
-              {     x, y - 1 - h, z + 1 },
-              { x + 1, y - 1 - h, z + 1 },
-            };
-
-            float n0 = 1.0;
-            float n1 = 1.0;
-            float n2 = 1.0;
-            float n3 = 1.0;
-            if (h == (dy - 1)) {
-              n2 *= 0.6;
-              n3 *= 0.6;
-            }
-            if (xl_h >= (y - h)) {
-              n0 *= 0.6;
-            }
-            if (xr_h >= (y - h)) {
-              n1 *= 0.6;
-            }
-            if (xl_h >= (y - h - 1)) {
-              n2 *= 0.6;
-            }
-            if (xr_h >= (y - h - 1)) {
-              n3 *= 0.6;
+                land_.appendTriangle(index + 0, index + 1, index + 2);
+                land_.appendTriangle(index + 1, index + 3, index + 2);
+                index += 4;
+              }
             }
+        
+            if ((height_map_[z + 1 + 1][x + 1] < y)) {
+              // 側面(z+)
+              int dy = y - height_map_[z + 1 + 1][x + 1];
+              int xl_h = height_map_[z + 1 + 1][x + 1 - 1];
+              int xr_h = height_map_[z + 1 + 1][x + 1 + 1];
+
+              for (int h = 0; h < dy; ++h) {
+                ci::vec3 p[] = {
+                  {     x,     y - h, z + 1 },
+                  { x + 1,     y - h, z + 1 },
+                  {     x, y - 1 - h, z + 1 },
+                  { x + 1, y - 1 - h, z + 1 },
+                };
+
+                float n0 = 1.0;
+                float n1 = 1.0;
+                float n2 = 1.0;
+                float n3 = 1.0;
+                if (h == (dy - 1)) {
+                  n2 *= 0.6;
+                  n3 *= 0.6;
+                }
+                if (xl_h >= (y - h)) {
+                  n0 *= 0.6;
+                }
+                if (xr_h >= (y - h)) {
+                  n1 *= 0.6;
+                }
+                if (xl_h >= (y - h - 1)) {
+                  n2 *= 0.6;
+                }
+                if (xr_h >= (y - h - 1)) {
+                  n3 *= 0.6;
+                }
             
-            ci::vec3 n[] = {
-              { 0, 0, n0 },
-              { 0, 0, n1 },
-              { 0, 0, n2 },
-              { 0, 0, n3 },
-            };
-
-            ci::vec2 uv[] = {
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-            };
+                ci::vec3 n[] = {
+                  { 0, 0, n0 },
+                  { 0, 0, n1 },
+                  { 0, 0, n2 },
+                  { 0, 0, n3 },
+                };
+
+                ci::vec2 uv[] = {
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                };
           
-            land_.appendPositions(&p[0], 4);
-            land_.appendNormals(&n[0], 4);
-            land_.appendTexCoords0(&uv[0], 4);
-        
-            land_.appendTriangle(index + 0, index + 3, index + 1);
-            land_.appendTriangle(index + 0, index + 2, index + 3);
-            index += 4;
-          }
-        }
+                land_.appendPositions(&p[0], 4);
+                land_.appendNormals(&n[0], 4);
+                land_.appendTexCoords0(&uv[0], 4);
         
-        if ((height_map_[z + 1][x - 1 + 1] < y)) {
-          // 側面(x-)
-          int dy = y - height_map_[z + 1][x - 1 + 1];
-          int zl_h = height_map_[z + 1 - 1][x - 1 + 1];
-          int zr_h = height_map_[z + 1 + 1][x - 1 + 1];
-
-          for (int h = 0; h < dy; ++h) {
-            ci::vec3 p[] = {
-              { x,     y - h,     z },
-              { x,     y - h, z + 1 },
-              { x, y - 1 - h,     z },
-              { x, y - 1 - h, z + 1 },
-            };
-
-            float n0 = -1.0;
-            float n1 = -1.0;
-            float n2 = -1.0;
-            float n3 = -1.0;
-            if (h == (dy - 1)) {
-              n2 *= 0.6;
-              n3 *= 0.6;
-            }
-            if (zl_h >= (y - h)) {
-              n0 *= 0.6;
-            }
-            if (zr_h >= (y - h)) {
-              n1 *= 0.6;
-            }
-            if (zl_h >= (y - h - 1)) {
-              n2 *= 0.6;
-            }
-            if (zr_h >= (y - h - 1)) {
-              n3 *= 0.6;
+                land_.appendTriangle(index + 0, index + 3, index + 1);
+                land_.appendTriangle(index + 0, index + 2, index + 3);
+                index += 4;
+              }
             }
+        
+            if ((height_map_[z + 1][x - 1 + 1] < y)) {
+              // 側面(x-)
+              int dy = y - height_map_[z + 1][x - 1 + 1];
+              int zl_h = height_map_[z + 1 - 1][x - 1 + 1];
+              int zr_h = height_map_[z + 1 + 1][x - 1 + 1];
+
+              for (int h = 0; h < dy; ++h) {
+                ci::vec3 p[] = {
+                  { x,     y - h,     z },
+                  { x,     y - h, z + 1 },
+                  { x, y - 1 - h,     z },
+                  { x, y - 1 - h, z + 1 },
+                };
+
+                float n0 = -1.0;
+                float n1 = -1.0;
+                float n2 = -1.0;
+                float n3 = -1.0;
+                if (h == (dy - 1)) {
+                  n2 *= 0.6;
+                  n3 *= 0.6;
+                }
+                if (zl_h >= (y - h)) {
+                  n0 *= 0.6;
+                }
+                if (zr_h >= (y - h)) {
+                  n1 *= 0.6;
+                }
+                if (zl_h >= (y - h - 1)) {
+                  n2 *= 0.6;
+                }
+                if (zr_h >= (y - h - 1)) {
+                  n3 *= 0.6;
+                }
           
-            ci::vec3 n[] = {
-              { n0, 0, 0 },
-              { n1, 0, 0 },
-              { n2, 0, 0 },
-              { n3, 0, 0 },
-            };
-
-            ci::vec2 uv[] = {
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-            };
+                ci::vec3 n[] = {
+                  { n0, 0, 0 },
+                  { n1, 0, 0 },
+                  { n2, 0, 0 },
+                  { n3, 0, 0 },
+                };
+
+                ci::vec2 uv[] = {
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                };
           
-            land_.appendPositions(&p[0], 4);
-            land_.appendNormals(&n[0], 4);
-            land_.appendTexCoords0(&uv[0], 4);
+                land_.appendPositions(&p[0], 4);
+                land_.appendNormals(&n[0], 4);
+                land_.appendTexCoords0(&uv[0], 4);
         
-            land_.appendTriangle(index + 0, index + 2, index + 1);
-            land_.appendTriangle(index + 1, index + 2, index + 3);
-            index += 4;
-          }
-        }
-        
-        if ((height_map_[z + 1][x + 1 + 1] < y)) {
-          // 側面(x+)
-          int dy = y - height_map_[z + 1][x + 1 + 1];
-          int zl_h = height_map_[z + 1 - 1][x + 1 + 1];
-          int zr_h = height_map_[z + 1 + 1][x + 1 + 1];
-
-          for (int h = 0; h < dy; ++h) {
-            ci::vec3 p[] = {
-              { x + 1,     y - h,     z },
-              { x + 1,     y - h, z + 1 },
-              { x + 1, y - 1 - h,     z },
-              { x + 1, y - 1 - h, z + 1 },
-            };
-
-            float n0 = 1.0;
-            float n1 = 1.0;
-            float n2 = 1.0;
-            float n3 = 1.0;
-            if (h == (dy - 1)) {
-              n2 *= 0.6;
-              n3 *= 0.6;
-            }
-            if (zl_h >= (y - h)) {
-              n0 *= 0.6;
-            }
-            if (zr_h >= (y - h)) {
-              n1 *= 0.6;
+                land_.appendTriangle(index + 0, index + 2, index + 1);
+                land_.appendTriangle(index + 1, index + 2, index + 3);
+                index += 4;
+              }
             }
-            if (zl_h >= (y - h - 1)) {
-              n2 *= 0.6;
-            }
-            if (zr_h >= (y - h - 1)) {
-              n3 *= 0.6;
-            }
-
-            ci::vec3 n[] = {
-              { n0, 0, 0 },
-              { n1, 0, 0 },
-              { n2, 0, 0 },
-              { n3, 0, 0 },
-            };
-
-            ci::vec2 uv[] = {
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-              { 0, p[0].y / 16.0f },
-            };
+        
+            if ((height_map_[z + 1][x + 1 + 1] < y)) {
+              // 側面(x+)
+              int dy = y - height_map_[z + 1][x + 1 + 1];
+              int zl_h = height_map_[z + 1 - 1][x + 1 + 1];
+              int zr_h = height_map_[z + 1 + 1][x + 1 + 1];
+
+              for (int h = 0; h < dy; ++h) {
+                ci::vec3 p[] = {
+                  { x + 1,     y - h,     z },
+                  { x + 1,     y - h, z + 1 },
+                  { x + 1, y - 1 - h,     z },
+                  { x + 1, y - 1 - h, z + 1 },
+                };
+
+                float n0 = 1.0;
+                float n1 = 1.0;
+                float n2 = 1.0;
+                float n3 = 1.0;
+                if (h == (dy - 1)) {
+                  n2 *= 0.6;
+                  n3 *= 0.6;
+                }
+                if (zl_h >= (y - h)) {
+                  n0 *= 0.6;
+                }
+                if (zr_h >= (y - h)) {
+                  n1 *= 0.6;
+                }
+                if (zl_h >= (y - h - 1)) {
+                  n2 *= 0.6;
+                }
+                if (zr_h >= (y - h - 1)) {
+                  n3 *= 0.6;
+                }
+
+                ci::vec3 n[] = {
+                  { n0, 0, 0 },
+                  { n1, 0, 0 },
+                  { n2, 0, 0 },
+                  { n3, 0, 0 },
+                };
+
+                ci::vec2 uv[] = {
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                  { 0, p[0].y / 16.0f },
+                };
           
-            land_.appendPositions(&p[0], 4);
-            land_.appendNormals(&n[0], 4);
-            land_.appendTexCoords0(&uv[0], 4);
+                land_.appendPositions(&p[0], 4);
+                land_.appendNormals(&n[0], 4);
+                land_.appendTexCoords0(&uv[0], 4);
         
-            land_.appendTriangle(index + 0, index + 1, index + 3);
-            land_.appendTriangle(index + 0, index + 3, index + 2);
-            index += 4;
+                land_.appendTriangle(index + 0, index + 1, index + 3);
+                land_.appendTriangle(index + 0, index + 3, index + 2);
+                index += 4;
+              }
+            }
           }
         }
+
+        // 小区画のAABBとインデックスの範囲を記録
+        if (land_.getNumIndices() == index_offset) continue;
+
+        const auto* positions = land_.getPositions<3>();
+        ci::vec3 min_pos = positions[vertex_offset];
+        ci::vec3 max_pos = positions[vertex_offset];
+        for (size_t i = vertex_offset; i < land_.getNumVertices(); ++i) {
+          min_pos = glm::min(min_pos, positions[i]);
+          max_pos = glm::max(max_pos, positions[i]);
+        }
+
+        Chunk chunk = {
+          ci::AxisAlignedBox(min_pos, max_pos),
+          uint32_t(index_offset),
+          uint32_t(land_.getNumIndices() - index_offset),
+        };
+        chunks_.push_back(chunk);
       }
     }
     aabb_ = land_.calcBoundingBox();
@@ -397,7 +456,7 @@ public:
     }
 
     // ステージ上に乗っかっているオブジェクトを生成
-    // createStageObjects(width, deep, factory);
+    createStageObjects(width, deep, offset_x, offset_z, factory);
   }
 
   
@@ -412,12 +471,23 @@ public:
   const ci::AxisAlignedBox& getAABB() const {
     return aabb_;
   }
+
+  const std::vector<Chunk>& getChunks() const {
+    return chunks_;
+  }
+
+  const RayTriangle::Triangles& getTriangles() const {
+    if (triangles_.num == 0) {
+      triangles_ = RayTriangle::Triangles(land_);
+    }
+    return triangles_;
+  }
   
   const ci::ivec2& getSize() const {
     return size_;
   }
 
-  const std::vector<StageObj> getStageObjects() const {
+  const std::vector<StageObj>& getStageObjects() const {
     return stage_objects_;
   }
 
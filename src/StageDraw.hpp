@@ -2,44 +2,147 @@
 
 // 
 // Stage描画
+//   地形のメッシュは共有の頂点・インデックスバッファへ格納し、
+//   数フレームに分けてGPUへ転送する
+//   転送が終わるまでは小区画単位の粗いメッシュで代用する
 //
 
+#include <cinder/Frustum.h>
 #include "TiledStage.hpp"
+#include "VisibleSet.hpp"
 #include "Light.hpp"
+#include "CookedTexture.hpp"
 #include "Misc.hpp"
+#include "RenderQueue.hpp"
+#include "UploadQueue.hpp"
+#include "GeometryArena.hpp"
 
 
 namespace ngs {
 
 class StageDrawer {
-  std::map<ci::ivec2, ci::gl::VboMeshRef, LessVec<ci::ivec2>> meshes_;
+  struct Resident {
+    // 転送が終わるまでは使えない
+    GeometryArena::AllocationRef allocation;
+
+    // 代わりに表示する粗いメッシュ
+    ci::gl::VboMeshRef coarse;
+  };
+
+  std::map<ci::ivec2, Resident, LessVec<ci::ivec2>> meshes_;
 
   ci::gl::Texture2dRef texture_;
   ci::gl::GlslProgRef	shader_;
+  // 地形の位置を描画ごとに指定する
+  ci::gl::GlslProgRef arena_shader_;
+
+  UploadQueue upload_queue_;
+  GeometryArena arena_;
+
+  // 描画した三角形の数
+  size_t triangle_num_ = 0;
+  // 粗いメッシュで描画した地形の数
+  size_t coarse_num_ = 0;
+
+
+  // 共有バッファへの格納と転送を予約する
+  void createMesh(Resident& resident, const ci::TriMesh& land) {
+    size_t vertex_num = land.getNumVertices();
+
+    // TIPS:地形は生成し直されることがあるので、転送するデータは複製しておく
+    const auto* positions  = land.getPositions<3>();
+    const auto& normals    = land.getNormals();
+    const auto* tex_coords = land.getTexCoords0<2>();
+
+    std::vector<GeometryArena::Vertex> vertices(vertex_num);
+    for (size_t i = 0; i < vertex_num; ++i) {
+      vertices[i].position  = positions[i];
+      vertices[i].normal    = normals[i];
+      vertices[i].tex_coord = tex_coords[i];
+    }
+
+    resident.allocation = arena_.allocate(vertices, land.getIndices());
+  }
+
+  // 小区画のAABBを箱にした粗いメッシュ
+  //   TIPS:底面は見えないので作らない
+  static ci::gl::VboMeshRef createCoarseMesh(const Stage& stage) {
+    ci::TriMesh mesh(ci::TriMesh::Format().positions().normals().texCoords0());
+
+    // 頂点の並びは上から見た時に a b / c d となる
+    auto append_face = [&mesh](const ci::vec3& a, const ci::vec3& b, const ci::vec3& c, const ci::vec3& d,
+                               const ci::vec3& normal) {
+      uint32_t index = mesh.getNumVertices();
+
+      ci::vec3 p[] = { a, b, c, d };
+      for (const auto& v : p) {
+        mesh.appendPosition(v);
+        mesh.appendNormal(normal);
+        mesh.appendTexCoord0(ci::vec2(0, v.y / 16.0f));
+      }
+
+      mesh.appendTriangle(index + 0, index + 1, index + 2);
+      mesh.appendTriangle(index + 1, index + 3, index + 2);
+    };
+
+    for (const auto& chunk : stage.getChunks()) {
+      const auto& min_pos = chunk.aabb.getMin();
+      const auto& max_pos = chunk.aabb.getMax();
+
+      float x0 = min_pos.x, y0 = min_pos.y, z0 = min_pos.z;
+      float x1 = max_pos.x, y1 = max_pos.y, z1 = max_pos.z;
+
+      // 上面
+      append_face({ x0, y1, z1 }, { x1, y1, z1 }, { x0, y1, z0 }, { x1, y1, z0 }, {  0, 1,  0 });
+      // 側面
+      append_face({ x0, y1, z0 }, { x1, y1, z0 }, { x0, y0, z0 }, { x1, y0, z0 }, {  0, 0, -1 });
+      append_face({ x1, y1, z1 }, { x0, y1, z1 }, { x1, y0, z1 }, { x0, y0, z1 }, {  0, 0,  1 });
+      append_face({ x0, y1, z1 }, { x0, y1, z0 }, { x0, y0, z1 }, { x0, y0, z0 }, { -1, 0,  0 });
+      append_face({ x1, y1, z0 }, { x1, y1, z1 }, { x1, y0, z0 }, { x1, y0, z1 }, {  1, 0,  0 });
+    }
+
+    return ci::gl::VboMesh::create(mesh);
+  }
 
   
 public:
-  StageDrawer() {
+  StageDrawer(const ci::JsonTree& params)
+    : shader_(createShader("texture", "texture")),
+      arena_shader_(createShader("texture", "texture", { "TILE_OFFSET" })),
+      upload_queue_(params.getValueForKey<size_t>("upload_budget")),
+      arena_(upload_queue_, arena_shader_,
+             params.getValueForKey<size_t>("arena_vertices"),
+             params.getValueForKey<size_t>("arena_indices"))
+  {
     // FIXME:WindowsではMagFilterにGL_NEARESTを指定すると描画が乱れる
-    texture_ = ci::gl::Texture2d::create(ci::loadImage(Asset::load("stage.png")),
-                                         ci::gl::Texture2d::Format()
-                                         .wrap(GL_CLAMP_TO_EDGE)
-                                         .minFilter(GL_NEAREST)
-                                         // .magFilter(GL_NEAREST)
-                                         );
-
-    shader_ = createShader("texture", "texture");
+    texture_ = CookedTexture::load("stage.png",
+                                   ci::gl::Texture2d::Format()
+                                   .wrap(GL_CLAMP_TO_EDGE)
+                                   .minFilter(GL_NEAREST)
+                                   // .magFilter(GL_NEAREST)
+                                   );
   }
 
   void clear() {
+    // TIPS:転送待ちは手放した時点で取り消される
     meshes_.clear();
   }
 
 
-  void setupLight(const Light& light) {
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
+  // 新しく見えた地形の転送を予約し、予算の範囲内で転送する
+  void update(const std::vector<VisibleStage>& stages) {
+    for (const auto& visible : stages) {
+      if (meshes_.count(visible.pos)) continue;
+
+      Resident resident;
+      createMesh(resident, visible.stage->getLandMesh());
+      if (resident.allocation) {
+        resident.coarse = createCoarseMesh(*visible.stage);
+      }
+      meshes_.insert(std::make_pair(visible.pos, resident));
+    }
+
+    upload_queue_.update();
   }
 
 
@@ -48,32 +151,91 @@ public:
   }
 
   
-  void draw(const ci::ivec2& pos, const Stage& stage) {
-    if (meshes_.count(pos) == 0) {
-      auto mesh = ci::gl::VboMesh::create(stage.getLandMesh());
-      meshes_.insert(std::make_pair(pos, mesh));
+  // offsetはワールド座標での地形の位置
+  //   視錐台に含まれる小区画だけ描画命令を積む
+  void draw(RenderQueue& queue, const Light& light,
+            const ci::ivec2& pos, const Stage& stage,
+            const ci::vec3& offset, const ci::mat4& transform,
+            const ci::Frustum& frustum) {
+    auto it = meshes_.find(pos);
+    if (it == std::end(meshes_)) return;
+
+    const auto& resident = it->second;
+    if (!resident.allocation) return;
+
+    if (!resident.allocation->isResident()) {
+      // 転送中
+      queue.draw(shader_.get(), texture_.get(), &light, resident.coarse, transform);
+      triangle_num_ += resident.coarse->getNumIndices() / 3;
+      coarse_num_   += 1;
+      return;
+    }
+
+    const auto& batch = arena_.getBatch();
+    uint32_t base = resident.allocation->index_offset;
+
+    // TIPS:小区画はインデックスが連続しているので
+    //      隣り合った小区画はまとめて描画する
+    uint32_t first = 0;
+    uint32_t count = 0;
+    for (const auto& chunk : stage.getChunks()) {
+      ci::AxisAlignedBox aabb(chunk.aabb.getMin() + offset, chunk.aabb.getMax() + offset);
+      if (!frustum.intersects(aabb)) continue;
+
+      if (count > 0 && (first + count) == chunk.index_offset) {
+        count += chunk.index_num;
+        continue;
+      }
+
+      if (count > 0) {
+        queue.drawRange(texture_.get(), &light, batch, base + first, count, offset);
+        triangle_num_ += count / 3;
+      }
+      first = chunk.index_offset;
+      count = chunk.index_num;
+    }
+
+    if (count > 0) {
+      queue.drawRange(texture_.get(), &light, batch, base + first, count, offset);
+      triangle_num_ += count / 3;
     }
+  }
+
+
+  size_t getTriangleNum() const {
+    return triangle_num_;
+  }
 
-    texture_->bind();
-    ci::gl::draw(meshes_.at(pos));
+  size_t getCoarseNum() const {
+    return coarse_num_;
   }
 
+  void resetTriangleNum() {
+    triangle_num_ = 0;
+    coarse_num_   = 0;
+  }
 
-  // 不要な地形データを破棄する
+  const UploadQueue::Stats& getUploadStats() const {
+    return upload_queue_.getStats();
+  }
+
+  GeometryArena::Stats getArenaStats() const {
+    return arena_.getStats();
+  }
+
+
+  // 中心から離れた地形データを破棄する
+  //   TIPS:破棄すると共有バッファの領域も解放される
   void garbageCollection(const ci::ivec2& center, const ci::ivec2& size) {
-    std::map<ci::ivec2, ci::gl::VboMeshRef, LessVec<ci::ivec2>> meshes;
-    
-    for (int z = -size.y; z < size.y; ++z) {
-      for (int x = -size.x; x < size.x; ++x) {
-        ci::ivec2 pos(x, z);
-        const auto& it = meshes_.find(pos);
-        if (it == std::end(meshes_)) continue;
-        
-        meshes.insert(std::make_pair(it->first, it->second));
+    for (auto it = std::begin(meshes_); it != std::end(meshes_); ) {
+      auto d = glm::abs(it->first - center);
+      if (d.x > size.x || d.y > size.y) {
+        it = meshes_.erase(it);
+      }
+      else {
+        ++it;
       }
     }
-    
-    std::swap(meshes_, meshes);
   }
   
 };
@@ -2,51 +2,143 @@
 
 //
 // ステージ上の物体の描画
+//   地形ごと・モデルごとに配置をまとめてインスタンス描画する
 //
 
-#include <cinder/ObjLoader.h>
+#include <cstddef>
+#include <glm/gtc/matrix_access.hpp>
 #include "StageObj.hpp"
 #include "StageObjMesh.hpp"
 #include "Light.hpp"
+#include "CookedTexture.hpp"
+#include "Misc.hpp"
+#include "RenderQueue.hpp"
 
 
 namespace ngs {
 
 class StageObjDrawer {
+  // インスタンスごとの情報
+  //   アフィン変換行列の上3行
+  struct Instance {
+    ci::vec4 row[3];
+  };
+
+  // 一つの地形に置かれた同じモデルの物体
+  struct Group {
+    ci::gl::VboRef   instance_vbo;
+    ci::gl::BatchRef batch;
+    uint32_t instance_num;
+  };
+
   StageObjMesh mesh_creater_;
   ci::gl::Texture2dRef texture_;
+  ci::gl::GlslProgRef shader_;
+
+  std::map<ci::ivec2, std::vector<Group>, LessVec<ci::ivec2>> groups_;
+
+  // 描画した物体の数
+  size_t instance_num_ = 0;
+
+
+  std::vector<Group> createGroups(const std::vector<StageObj>& objects) {
+    // モデルごとに仕分ける
+    std::map<std::string, std::vector<Instance>> instances;
+    for (const auto& obj : objects) {
+      const auto& m = obj.getTransfomation();
+      Instance instance = {
+        { glm::row(m, 0), glm::row(m, 1), glm::row(m, 2) }
+      };
+      instances[obj.getName()].push_back(instance);
+    }
 
-  std::map<ci::ivec2, ci::gl::VboMeshRef, LessVec<ci::ivec2>> meshes_;
+    ci::geom::BufferLayout layout;
+    layout.append(ci::geom::Attrib::CUSTOM_0, 4, sizeof(Instance), offsetof(Instance, row[0]), 1);
+    layout.append(ci::geom::Attrib::CUSTOM_1, 4, sizeof(Instance), offsetof(Instance, row[1]), 1);
+    layout.append(ci::geom::Attrib::CUSTOM_2, 4, sizeof(Instance), offsetof(Instance, row[2]), 1);
+
+    std::vector<Group> groups;
+    for (const auto& it : instances) {
+      const auto& data = it.second;
+      auto vbo = ci::gl::Vbo::create(GL_ARRAY_BUFFER, data.size() * sizeof(Instance), &data[0], GL_STATIC_DRAW);
+
+      Group group = {
+        vbo,
+        mesh_creater_.createBatch(it.first, layout, vbo, shader_, {
+            { ci::geom::Attrib::CUSTOM_0, "InstanceRow0" },
+            { ci::geom::Attrib::CUSTOM_1, "InstanceRow1" },
+            { ci::geom::Attrib::CUSTOM_2, "InstanceRow2" },
+          }),
+        uint32_t(data.size()),
+      };
+      groups.push_back(group);
+    }
+
+    return groups;
+  }
 
 
 public:
-  StageObjDrawer() {
+  StageObjDrawer(const ci::JsonTree& params) {
     // FIXME:WindowsではMagFilterにGL_NEARESTを指定すると描画が乱れる
-    texture_ = ci::gl::Texture2d::create(ci::loadImage(Asset::load("stage_obj.png")),
-                                         ci::gl::Texture2d::Format()
-                                         .wrap(GL_CLAMP_TO_EDGE)
-                                         .minFilter(GL_NEAREST)
-                                         // .magFilter(GL_NEAREST)
-                                         );
+    texture_ = CookedTexture::load("stage_obj.png",
+                                   ci::gl::Texture2d::Format()
+                                   .wrap(GL_CLAMP_TO_EDGE)
+                                   .minFilter(GL_NEAREST)
+                                   // .magFilter(GL_NEAREST)
+                                   );
+
+    // 地形と同じシェーダーに、インスタンスごとの変換を加えたもの
+    shader_ = createShader("texture", "texture", { "INSTANCE_TRANSFORM" });
+
+    // 登場するモデルは先に読み込んでおく
+    for (const auto& p : params) {
+      mesh_creater_.getMesh(p.getValueForKey<std::string>("name"));
+    }
   }
 
   void clear() {
-    meshes_.clear();
+    groups_.clear();
   }
 
-  
-  void draw(const ci::ivec2& pos, const Stage& stage) {
+
+  void draw(RenderQueue& queue, const Light& light,
+            const ci::ivec2& pos, const Stage& stage, const ci::mat4& transform) {
     if (stage.getStageObjects().empty()) return;
-    
-    if (meshes_.count(pos) == 0) {
-      auto mesh = mesh_creater_.createBatch(stage.getStageObjects());
-      meshes_.insert(std::make_pair(pos, mesh));
+
+    if (groups_.count(pos) == 0) {
+      groups_.insert(std::make_pair(pos, createGroups(stage.getStageObjects())));
     }
 
-    texture_->bind();
-    ci::gl::draw(meshes_.at(pos));
+    for (const auto& group : groups_.at(pos)) {
+      queue.drawInstanced(texture_.get(), &light, group.batch, group.instance_num, transform);
+      instance_num_ += group.instance_num;
+    }
+  }
+
+
+  size_t getInstanceNum() const {
+    return instance_num_;
   }
-    
+
+  void resetInstanceNum() {
+    instance_num_ = 0;
+  }
+
+
+  // 中心から離れた地形の配置を破棄
+  void garbageCollection(const ci::ivec2& center, const ci::ivec2& size) {
+    for (auto it = std::begin(groups_); it != std::end(groups_); ) {
+      auto d = glm::abs(it->first - center);
+      if (d.x > size.x || d.y > size.y) {
+        it = groups_.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
 };
 
 }
@@ -37,12 +37,12 @@ public:
   }
     
 
-  std::pair<bool, std::string> create(const int height) const {
+  std::pair<bool, std::string> create(const int height, ci::Rand& rand) const {
     if (!info_.count(height)) {
       return std::make_pair(false, std::string());
     }
 
-    float probability = ci::randFloat();
+    float probability = rand.nextFloat();
     const auto& info = info_.at(height);
     for (const auto& i : info) {
       if (probability < i.probability) {
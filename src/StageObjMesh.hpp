@@ -1,41 +1,48 @@
 ﻿#pragma once
 
 //
-// ステージ上の物体を生成
+// ステージ上の物体のモデル
+//   モデルごとに頂点バッファを一つだけ持ち、地形ごとの配置はインスタンス情報で与える
 //
 
-#include "Asset.hpp"
+#include <cinder/gl/Batch.h>
+#include <cinder/gl/VboMesh.h>
+#include "CookedMesh.hpp"
 
 
 namespace ngs {
 
 class StageObjMesh {
-  std::map<std::string, ci::TriMesh> meshes_;
+  std::map<std::string, ci::gl::VboMeshRef> meshes_;
 
 
-  ci::TriMesh& loadMesh(const std::string& path) {
-    if (!meshes_.count(path)) {
-      ci::ObjLoader loader(Asset::load(path));
-      ci::TriMesh mesh(loader);
+public:
+  StageObjMesh() = default;
 
-      meshes_.insert(std::make_pair(path, mesh));
+  const ci::gl::VboMeshRef& getMesh(const std::string& path) {
+    if (!meshes_.count(path)) {
+      meshes_.insert(std::make_pair(path, CookedMesh::load(path)));
     }
-    
+
     return meshes_.at(path);
   }
 
-  
-public:
-  StageObjMesh() = default;
+  // モデルの頂点バッファにインスタンス情報のバッファを加えて描画の準備をする
+  //   TIPS:頂点バッファは複製せず、全ての地形で共有する
+  ci::gl::BatchRef createBatch(const std::string& path,
+                               const ci::geom::BufferLayout& instance_layout,
+                               const ci::gl::VboRef& instance_vbo,
+                               const ci::gl::GlslProgRef& shader,
+                               const ci::gl::Batch::AttributeMapping& mapping) {
+    const auto& model = getMesh(path);
 
-  ci::gl::VboMeshRef createBatch(const std::vector<StageObj>& objects) {
-    ci::geom::SourceMods mods;
-    for (const auto& obj : objects) {
-      // モデルをアフィン変換して追加
-      mods &= loadMesh(obj.getName()) >> ci::geom::Transform(obj.getTransfomation());
-    }
+    auto buffers = model->getVertexArrayLayoutVbos();
+    buffers.push_back(std::make_pair(instance_layout, instance_vbo));
+
+    auto mesh = ci::gl::VboMesh::create(model->getNumVertices(), model->getGlPrimitive(), buffers,
+                                        model->getNumIndices(), model->getIndexDataType(), model->getIndexVbo());
 
-    return ci::gl::VboMesh::create(mods);
+    return ci::gl::Batch::create(mesh, shader, mapping);
   }
 
 };
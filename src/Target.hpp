@@ -24,14 +24,6 @@ class Target {
   bool active_;
   
 
-
-  void setupLight(const Light& light) {
-    shader_->uniform("LightPosition", light.direction);
-    shader_->uniform("LightAmbient",  light.ambient);
-    shader_->uniform("LightDiffuse",  light.diffuse);
-  }
-
-  
 public:
   Target(const ci::JsonTree& params)
     : scaling_(Json::getVec<ci::vec3>(params["scaling"])),
@@ -41,7 +33,7 @@ public:
       active_(false)
   {
     shader_ = createShader("color", "color");
-    model_  = ci::gl::VboMesh::create(PLY::load("target.ply"));
+    model_  = CookedMesh::load("target.ply");
   }
 
 
@@ -69,20 +61,15 @@ public:
     }
   }
 
-  void draw(const Light& light) {
+  void draw(RenderQueue& queue, const Light& light) {
     if (!active_) return;
 
-    setupLight(light);
-    
     ci::mat4 transform = glm::translate(position_)
                        * glm::mat4_cast(swing_)
                        * glm::scale(scaling_)
                        * glm::translate(offset_);
 
-    ci::gl::setModelMatrix(transform);
-
-    ci::gl::ScopedGlslProg shader(shader_);
-    ci::gl::draw(model_);
+    queue.draw(shader_.get(), nullptr, &light, model_, transform);
   }
   
 };
@@ -27,6 +27,13 @@ class TiledStage {
   
   std::map<ci::ivec2, Stage, LessVec<ci::ivec2>> stages_;
   std::map<ci::ivec2, std::vector<Relic>, LessVec<ci::ivec2>> relics_;
+
+  // 生成済みの地形のAABB
+  // TIPS:可視判定に使う。地形と同じ範囲で破棄する
+  std::map<ci::ivec2, ci::AxisAlignedBox, LessVec<ci::ivec2>> aabbs_;
+
+  // 地形を生成した累計数
+  size_t generated_num_ = 0;
   
 
   void createRelics(const ci::ivec2& pos, const std::vector<std::vector<int>>& height_map) {
@@ -74,9 +81,12 @@ public:
                                           random_,
                                           stageobj_factory_,
                                           random_scale_)));
+      generated_num_ += 1;
+
+      const auto& stage = stages_.at(pos);
+      aabbs_[pos] = stage.getAABB();
 
       if (!hasRelics(pos)) {
-        const auto& stage = stages_.at(pos);
         createRelics(pos, stage.getHeightMap());
       }
     }
@@ -84,6 +94,20 @@ public:
     return stages_.at(pos);
   }
 
+  // 地形を生成せずにAABBを求める
+  //   一度も生成していない場合は高さの範囲から求めた大きめのAABB
+  ci::AxisAlignedBox getStageAABB(const ci::ivec2& pos) const {
+    const auto& it = aabbs_.find(pos);
+    if (it != std::end(aabbs_)) return it->second;
+
+    return ci::AxisAlignedBox(ci::vec3(0, Stage::HEIGHT_MIN, 0),
+                              ci::vec3(block_size_, Stage::HEIGHT_MAX, block_size_));
+  }
+
+  size_t getGeneratedNum() const {
+    return generated_num_;
+  }
+
   const std::vector<Relic>& getRelics(const ci::ivec2& pos) const {
     return relics_.at(pos);
   }
@@ -160,21 +184,31 @@ public:
   }
 
 
-  // 不要な地形データを破棄する
+  // 中心から離れた地形データを破棄する
+  //   TIPS:AABBも捨てる(再び近づいた時は高さの範囲から求めたもので判定する)
   void garbageCollection(const ci::ivec2& center, const ci::ivec2& size) {
-    std::map<ci::ivec2, Stage, LessVec<ci::ivec2>> stages;
-    
-    for (int z = -size.y; z < size.y; ++z) {
-      for (int x = -size.x; x < size.x; ++x) {
-        ci::ivec2 pos(x, z);
-        const auto& it = stages_.find(pos);
-        if (it == std::end(stages_)) continue;
-        
-        stages.insert(std::make_pair(it->first, it->second));
+    auto isFar = [&center, &size](const ci::ivec2& pos) {
+      auto d = glm::abs(pos - center);
+      return d.x > size.x || d.y > size.y;
+    };
+
+    for (auto it = std::begin(stages_); it != std::end(stages_); ) {
+      if (isFar(it->first)) {
+        it = stages_.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+
+    for (auto it = std::begin(aabbs_); it != std::end(aabbs_); ) {
+      if (isFar(it->first)) {
+        it = aabbs_.erase(it);
+      }
+      else {
+        ++it;
       }
     }
-    
-    std::swap(stages_, stages);
   }
   
 };
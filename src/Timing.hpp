@@ -0,0 +1,191 @@
+﻿#pragma once
+
+//
+// 処理時間の計測
+//   入れ子になった区間を記録し、起動から最初のフレームまでや画面の切り替えの内訳を調べる
+//   時刻は最初に計測した時(ほぼ起動時)からの秒数
+//
+//   TIPS:入れ子はスレッドごとに管理する
+//        別スレッドの区間は、親を指定しないと一番外側になる
+//
+
+#include <cinder/Filesystem.h>
+#include <cinder/Json.h>
+#include <cinder/Timer.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace ngs {
+
+class Timing {
+public:
+  struct Phase {
+    std::string name;
+    // 親の区間(無ければ-1)
+    int parent;
+    int depth;
+    // 記録したスレッド(メインスレッドが0)
+    int thread;
+
+    double begin;
+    double end;
+  };
+
+
+private:
+  ci::Timer timer_;
+
+  mutable std::mutex mutex_;
+  std::vector<Phase> phases_;
+
+  // スレッドごとの計測中の区間
+  std::map<std::thread::id, std::vector<int>> stacks_;
+  std::map<std::thread::id, int> threads_;
+
+
+  int getThread(const std::thread::id& id) {
+    auto it = threads_.find(id);
+    if (it != std::end(threads_)) return it->second;
+
+    int index = int(threads_.size());
+    threads_.insert(std::make_pair(id, index));
+    return index;
+  }
+
+  ci::JsonTree createJson(const int index) const {
+    const auto& phase = phases_[index];
+
+    auto json = ci::JsonTree::makeObject();
+    json.pushBack(ci::JsonTree("name",   phase.name));
+    json.pushBack(ci::JsonTree("thread", phase.thread));
+    json.pushBack(ci::JsonTree("begin",  phase.begin * 1000.0));
+    json.pushBack(ci::JsonTree("end",    phase.end * 1000.0));
+    json.pushBack(ci::JsonTree("msec",   (phase.end - phase.begin) * 1000.0));
+
+    auto children = ci::JsonTree::makeArray("children");
+    for (size_t i = index + 1; i < phases_.size(); ++i) {
+      if (phases_[i].parent == index) children.pushBack(createJson(int(i)));
+    }
+    if (children.hasChildren()) json.pushBack(children);
+
+    return json;
+  }
+
+
+public:
+  Timing() {
+    timer_.start();
+  }
+
+
+  double getSeconds() const {
+    return timer_.getSeconds();
+  }
+
+  // 区間の開始
+  //   parent 親を指定する場合(-1ならこのスレッドで計測中の区間)
+  int begin(const std::string& name, const int parent = -1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto id = std::this_thread::get_id();
+    auto& stack = stacks_[id];
+
+    Phase phase;
+    phase.name   = name;
+    phase.parent = (parent >= 0) ? parent
+                                 : (stack.empty() ? -1 : stack.back());
+    phase.depth  = (phase.parent >= 0) ? phases_[phase.parent].depth + 1 : 0;
+    phase.thread = getThread(id);
+    phase.begin  = timer_.getSeconds();
+    phase.end    = phase.begin;
+
+    int index = int(phases_.size());
+    phases_.push_back(phase);
+    stack.push_back(index);
+    return index;
+  }
+
+  void end(const int index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    phases_[index].end = timer_.getSeconds();
+
+    auto& stack = stacks_[std::this_thread::get_id()];
+    auto it = std::find(std::begin(stack), std::end(stack), index);
+    if (it != std::end(stack)) stack.erase(it);
+  }
+
+  // 長さの無い区間(最初のフレームなどの目印)
+  void mark(const std::string& name) {
+    end(begin(name));
+  }
+
+
+  // JSON形式で書き出す
+  void write(const ci::fs::path& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto phases = ci::JsonTree::makeArray("phases");
+    for (size_t i = 0; i < phases_.size(); ++i) {
+      if (phases_[i].parent < 0) phases.pushBack(createJson(int(i)));
+    }
+
+    ci::JsonTree json;
+    json.pushBack(phases);
+    json.write(path);
+  }
+
+  // 内訳を出力
+  //   min_msec より短い区間は省略する
+  void report(const double min_msec = 0.1) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (const auto& phase : phases_) {
+      double msec = (phase.end - phase.begin) * 1000.0;
+      if ((msec < min_msec) && (phase.end != phase.begin)) continue;
+
+      DOUT << std::string(phase.depth * 2, ' ')
+           << phase.name
+           << " " << msec << " ms"
+           << " (at " << phase.begin * 1000.0 << " ms"
+           << (phase.thread ? ", thread " + std::to_string(phase.thread) : std::string())
+           << ")" << std::endl;
+    }
+  }
+
+};
+
+
+// アプリ全体で一つだけ
+//   TIPS:最初に使った時から時刻を数える
+Timing& getTiming() {
+  static Timing timing;
+  return timing;
+}
+
+
+// スコープを抜けるまでを計測
+class ScopedTiming {
+  int index_;
+
+
+public:
+  explicit ScopedTiming(const std::string& name, const int parent = -1)
+    : index_(getTiming().begin(name, parent))
+  {}
+
+  ~ScopedTiming() {
+    getTiming().end(index_);
+  }
+
+  ScopedTiming(const ScopedTiming&) = delete;
+  ScopedTiming& operator=(const ScopedTiming&) = delete;
+
+};
+
+}
@@ -0,0 +1,153 @@
+﻿#pragma once
+
+//
+// GPUへの転送待ち行列
+//   1フレームに転送する量を制限し、数フレームに分けて書き込む
+//
+
+#include <cinder/gl/Vbo.h>
+#include <cinder/Timer.h>
+#include <deque>
+#include <memory>
+#include <vector>
+
+
+namespace ngs {
+
+class UploadQueue {
+public:
+  // 転送の進み具合
+  //   TIPS:受け取った側が手放すと、残りの転送は取り消される
+  struct Ticket {
+    size_t remaining = 0;
+
+    bool isDone() const {
+      return remaining == 0;
+    }
+  };
+
+  using TicketRef = std::shared_ptr<Ticket>;
+
+
+  // 1フレームの転送量
+  struct Stats {
+    size_t uploaded_bytes = 0;
+    double upload_time    = 0.0;
+    // 転送待ちの量
+    size_t pending_bytes = 0;
+  };
+
+
+private:
+  struct Task {
+    ci::gl::VboRef vbo;
+    // 書き込み先の位置
+    size_t destination;
+    std::vector<uint8_t> data;
+    // 転送済みのバイト数
+    size_t offset;
+
+    std::weak_ptr<Ticket> ticket;
+  };
+
+  std::deque<Task> tasks_;
+
+  // 1フレームに転送するバイト数
+  size_t budget_;
+
+  size_t pending_bytes_ = 0;
+  Stats stats_;
+
+
+public:
+  explicit UploadQueue(const size_t budget)
+    : budget_(std::max(budget, size_t(1)))
+  {}
+
+
+  TicketRef createTicket() const {
+    return std::make_shared<Ticket>();
+  }
+
+  // 転送を予約
+  //   vboはdestinationから転送する量以上の大きさで確保しておくこと
+  void push(const TicketRef& ticket, const ci::gl::VboRef& vbo, const size_t destination,
+            std::vector<uint8_t> data) {
+    if (data.empty()) return;
+
+    ticket->remaining += data.size();
+    pending_bytes_    += data.size();
+
+    Task task = {
+      vbo,
+      destination,
+      std::move(data),
+      0,
+      ticket,
+    };
+    tasks_.push_back(std::move(task));
+  }
+
+
+  // 予約順に、予算の範囲内で転送する
+  void update() {
+    ci::Timer timer(true);
+
+    size_t bytes = process(budget_);
+
+    stats_.uploaded_bytes = bytes;
+    stats_.upload_time    = timer.getSeconds();
+    stats_.pending_bytes  = pending_bytes_;
+  }
+
+  // 予算に関係なく全て転送する
+  void flush() {
+    ci::Timer timer(true);
+
+    size_t bytes = process(pending_bytes_);
+
+    stats_.uploaded_bytes += bytes;
+    stats_.upload_time    += timer.getSeconds();
+    stats_.pending_bytes   = pending_bytes_;
+  }
+
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+
+private:
+  size_t process(const size_t budget) {
+    size_t bytes = 0;
+    while (!tasks_.empty() && (bytes < budget)) {
+      auto& task = tasks_.front();
+      size_t rest = task.data.size() - task.offset;
+
+      auto ticket = task.ticket.lock();
+      if (!ticket) {
+        // 取り消された
+        pending_bytes_ -= rest;
+        tasks_.pop_front();
+        continue;
+      }
+
+      size_t size = std::min(rest, budget - bytes);
+      task.vbo->bufferSubData(task.destination + task.offset, size, &task.data[task.offset]);
+
+      task.offset       += size;
+      ticket->remaining -= size;
+      pending_bytes_    -= size;
+      bytes             += size;
+
+      if (task.offset == task.data.size()) {
+        tasks_.pop_front();
+      }
+    }
+
+    return bytes;
+  }
+
+};
+
+}
@@ -0,0 +1,167 @@
+﻿#pragma once
+
+//
+// 1フレーム中に見えている地形
+//   カメラ更新後に一度だけ作り、描画やクリック判定で使い回す
+//
+
+#include <cinder/Camera.h>
+#include <cinder/Frustum.h>
+#include <cinder/Ray.h>
+#include "TiledStage.hpp"
+
+
+namespace ngs {
+
+struct VisibleStage {
+  ci::ivec2 pos;
+
+  const Stage* stage;
+  std::vector<Relic>* relics;
+
+  // ワールド座標での位置
+  ci::vec3 offset;
+  ci::mat4 transform;
+};
+
+
+class VisibleSet {
+  enum {
+    // 中央ブロックから調べる範囲
+    RANGE = 3,
+    WIDTH = RANGE * 2 + 1,
+  };
+
+  ci::ivec2 center_;
+  ci::Frustum frustum_;
+
+  std::vector<VisibleStage> stages_;
+
+  // 視錐台の外と判定した数
+  int culled_num_ = 0;
+
+  bool valid_ = false;
+
+
+  // 地形を生成せずに得られるAABBで判定し、
+  // 視錐台に含まれたブロックだけ周囲を幅優先で調べる
+  void checkContainsStage(TiledStage& stage, const float sea_level) {
+    const int block_size = stage.getBlockSize();
+
+    bool checked[WIDTH][WIDTH] = {};
+
+    ci::ivec2 queue[WIDTH * WIDTH];
+    size_t head = 0;
+    size_t tail = 0;
+
+    queue[tail++] = ci::ivec2(0, 0);
+    checked[RANGE][RANGE] = true;
+
+    while (head < tail) {
+      ci::ivec2 ofs = queue[head++];
+
+      // 判定用のAABBを取得
+      ci::ivec2 stage_pos(ofs + center_);
+      const auto& b = stage.getStageAABB(stage_pos);
+
+      // TIPS:海面の描画を含む
+      ci::vec3 min_pos = b.getMin();
+      ci::vec3 max_pos = b.getMax();
+      max_pos.y = std::max(max_pos.y, sea_level);
+
+      ci::vec3 pos(stage_pos.x * block_size, 0, stage_pos.y * block_size);
+      ci::AxisAlignedBox aabb(min_pos + pos, max_pos + pos);
+      if (!frustum_.intersects(aabb)) {
+        culled_num_ += 1;
+        continue;
+      }
+
+      // TIPS:視錐台に含まれた地形だけ生成される
+      VisibleStage visible = {
+        stage_pos,
+        &stage.getStage(stage_pos),
+        &stage.getRelics(stage_pos),
+        pos,
+        glm::translate(pos),
+      };
+      stages_.push_back(visible);
+
+      // 周囲の地形も調べる
+      ci::ivec2 vector[] = {
+        { -1,  0 },
+        {  1,  0 },
+        {  0, -1 },
+        {  0,  1 },
+      };
+
+      for (const auto& v : vector) {
+        ci::ivec2 next = ofs + v;
+        if (std::abs(next.x) > RANGE || std::abs(next.y) > RANGE) continue;
+
+        bool& c = checked[next.x + RANGE][next.y + RANGE];
+        if (c) continue;
+        c = true;
+
+        queue[tail++] = next;
+      }
+    }
+  }
+
+
+public:
+  VisibleSet() = default;
+
+
+  // カメラから見える地形を選出
+  void update(const ci::CameraPersp& camera, TiledStage& stage, const float sea_level) {
+    clear();
+
+    // 画面中央の座標をレイキャストして中央ブロックを求める
+    ci::Ray ray = camera.generateRay(0.5f, 0.5f,
+                                     camera.getAspectRatio());
+
+    float z;
+    if (!ray.calcPlaneIntersection(ci::vec3(0, 0, 0), ci::vec3(0, 1, 0), &z)) return;
+
+    ci::vec3 p = ray.calcPosition(z);
+    const int block_size = stage.getBlockSize();
+    center_ = ci::ivec2(glm::floor(p.x / block_size), glm::floor(p.z / block_size));
+
+    frustum_ = ci::Frustum(camera);
+    checkContainsStage(stage, sea_level);
+
+    valid_ = true;
+  }
+
+  // 地形を作り直した時は必ず呼ぶ
+  void clear() {
+    // TIPS:確保済みのメモリは使い回す
+    stages_.clear();
+    culled_num_ = 0;
+    valid_      = false;
+  }
+
+
+  bool isValid() const {
+    return valid_;
+  }
+
+  const ci::ivec2& getCenter() const {
+    return center_;
+  }
+
+  const ci::Frustum& getFrustum() const {
+    return frustum_;
+  }
+
+  const std::vector<VisibleStage>& getStages() const {
+    return stages_;
+  }
+
+  int getCulledNum() const {
+    return culled_num_;
+  }
+
+};
+
+}
@@ -12,6 +12,12 @@
 #include "SceneGame.hpp"
 #include "SceneItemReporter.hpp"
 #include "Audio.hpp"
+#include "Preloader.hpp"
+#include "Timing.hpp"
+#if defined (DEBUG)
+#include "RayTriangleTest.hpp"
+#include "RenderQueueTest.hpp"
+#endif
 #include <deque>
 
 
@@ -22,8 +28,13 @@ class Worker {
   Event event_;
   ConnectionHolder holder_;
 
+  // 起動から最初のフレームまでの計測(終わったら-1)
+  int startup_timing_;
+  int preload_timing_;
+  bool loading_frame_ = false;
+
   // ゲーム内パラメーター
-  ci::JsonTree params_;
+  const Params& params_;
 
   // UIなどきっかけが必要な演出用
   ci::TimelineRef timeline_;
@@ -34,7 +45,13 @@ class Worker {
   // 現在の画面
   std::deque<std::shared_ptr<SceneBase>> scene_stack_;
 
-  Audio audio_;
+  std::unique_ptr<Audio> audio_;
+
+  // アイテム発見画面のモデル
+  std::unique_ptr<ItemModel> item_model_;
+
+  // 起動時の先読み
+  std::unique_ptr<Preloader> preloader_;
   
 
   ci::gl::FboRef createSnapshot(const std::shared_ptr<SceneBase>& scene) {
@@ -57,38 +74,153 @@ class Worker {
     holder_ += event_.connect("scene_game",
                               [this](const Arguments&) {
                                 DOUT << "scene_game" << std::endl;
+                                ScopedTiming timing("scene_game");
 
-                                scene_stack_.push_front(std::make_shared<SceneGame>(event_, params_, game_));
+                                scene_stack_.push_front(std::make_shared<SceneGame>(event_, params_.json, game_));
                               });
 
     holder_ += event_.connect("scene_item_reporter",
                               [this](const Arguments& arguments) {
                                 DOUT << "scene_item_reporter" << std::endl;
+                                ScopedTiming timing("scene_item_reporter");
 
                                 // 直前の画面のsnapshot
-                                auto fbo      = createSnapshot(scene_stack_.front());
+                                ci::gl::FboRef fbo;
+                                {
+                                  ScopedTiming snapshot_timing("snapshot");
+                                  fbo = createSnapshot(scene_stack_.front());
+                                }
                                 auto index    = boost::any_cast<int>(arguments.at("item"));
                                 auto new_item = boost::any_cast<bool>(arguments.at("new_item"));
                      
-                                scene_stack_.push_front(std::make_shared<SceneItemReporter>(event_, params_, timeline_,
+                                scene_stack_.push_front(std::make_shared<SceneItemReporter>(event_, *item_model_, params_.json, timeline_,
                                                                                             fbo, index, new_item));
                               });
   }
+
+
+  // 先読みの準備
+  //   ファイルの読み込みと展開は別スレッド、GL・オーディオの生成はメインスレッド
+  void setupPreloader() {
+    preloader_ = std::unique_ptr<Preloader>(new Preloader);
+
+    std::vector<std::string> game_depends;
+    
+    // 画像
+    const std::vector<std::string> images = {
+      params_.json.getValueForKey<std::string>("sea.wave_texture"),
+      "stage.png",
+      "stage_obj.png",
+    };
+    for (const auto& path : images) {
+      preloader_->add(path, [path]() { CookedTexture::preload(path); });
+      game_depends.push_back(path);
+    }
+
+    // メッシュ
+    std::vector<std::string> meshes = {
+      "relic.obj",
+      "relic_get.obj",
+      "route.obj",
+      "ship.ply",
+      "target.ply",
+    };
+    for (const auto& p : params_.json["stage_obj"]) {
+      meshes.push_back(p.getValueForKey<std::string>("name"));
+    }
+    for (const auto& path : meshes) {
+      preloader_->add(path, [path]() { CookedMesh::preload(path); });
+      game_depends.push_back(path);
+    }
+    // アイテム発見画面
+    // TIPS:転送も1フレームに1つずつ行い、発見した時に読み込まずに済むようにする
+    preloader_->addMain("item_model",
+                        [this]() {
+                          item_model_ = std::unique_ptr<ItemModel>(new ItemModel);
+                        });
+    for (const auto& path : ItemModel::getFiles(params_)) {
+      preloader_->add(path, [path]() { CookedMesh::preload(path); });
+      preloader_->addMain("item_model:" + path,
+                          [this, path]() {
+                            item_model_->load(path);
+                          },
+                          { "item_model", path });
+    }
+
+    preloader_->addMain("game",
+                        [this]() {
+                          game_ = std::make_shared<Game>(event_, params_);
+                        },
+                        game_depends);
+
+    // TIPS:効果音はAudioが自前のスレッドで先読みするので、ここでは待たない
+    preloader_->addMain("audio",
+                        [this]() {
+                          audio_ = std::unique_ptr<Audio>(new Audio(params_.json["audio"], params_.json["audio_cache"]));
+                        });
+
+    preload_timing_ = getTiming().begin("preload");
+    preloader_->start(preload_timing_);
+  }
+
+  // 先読みが終わった
+  void finishPreload() {
+    getTiming().end(preload_timing_);
+
+    // 最初のシーンを生成
+    event_.signal("scene_game");
+    resize(ci::app::getWindowAspectRatio());
+
+    reportShaderStats();
+    CookedMesh::reportStats();
+    CookedTexture::reportStats();
+    Asset::reportStats();
+    audio_->reportStats();
+    DOUT << "preload threads: " << preloader_->getThreadNum() << std::endl;
+
+    preloader_.reset();
+  }
+
+  // 起動から最初のフレームまでの内訳を出力
+  void finishStartup() {
+    auto& timing = getTiming();
+    timing.mark("first_game_frame");
+    timing.end(startup_timing_);
+    startup_timing_ = -1;
+
+    timing.report();
+    timing.write(getDocumentPath() / "timing.json");
+  }
+
+  // 読み込み中の画面
+  void drawLoading() {
+    ci::gl::clear(ci::Color(0, 0, 0));
+
+    ci::gl::setMatricesWindow(ci::app::getWindowSize());
+    ci::vec2 size = ci::app::getWindowSize();
+    ci::Rectf bar(size.x * 0.25f, size.y * 0.5f - 2.0f, size.x * 0.75f, size.y * 0.5f + 2.0f);
+
+    ci::gl::color(0.2f, 0.2f, 0.2f);
+    ci::gl::drawSolidRect(bar);
+
+    bar.x2 = ci::lerp(bar.x1, bar.x2, preloader_->getProgress());
+    ci::gl::color(1.0f, 1.0f, 1.0f);
+    ci::gl::drawSolidRect(bar);
+  }
   
 
 public:
   Worker()
-    : params_(Params::load("params.json")),
-      timeline_(ci::Timeline::create()),
-      game_(std::make_shared<Game>(event_, params_)),
-      audio_(params_["audio"])
+    : startup_timing_(getTiming().begin("startup")),
+      params_(Params::get()),
+      timeline_(ci::Timeline::create())
   {
     setupFactory();
 
     holder_ += event_.connect("audio",
                               [this](const Arguments& arguments) {
                                 const auto& name = boost::any_cast<const std::string&>(arguments.at("name"));
-                                audio_.play(name);
+                                if (audio_) audio_->play(name);
                               });
 
     // サウンドデバッグ用
@@ -96,9 +228,9 @@ public:
                               [this](const Arguments&) {
                                 DOUT << "audio_test" << std::endl;
 
-                                int num = params_["audio"].getNumChildren();
+                                int num = params_.json["audio"].getNumChildren();
                                 int index = ci::randInt(num);
-                                const auto& name = params_["audio"][index].getValueForKey<std::string>("name");
+                                const auto& name = params_.json["audio"][index].getValueForKey<std::string>("name");
 
                                 Arguments arguments = {
                                   { "name", name },
@@ -111,16 +243,75 @@ public:
                               [this](const Arguments&) {
                                 DOUT << "audio_stop" << std::endl;
                                 
-                                audio_.stopAll();
+                                if (audio_) audio_->stopAll();
                               });
-    
-    // 最初のシーンを生成
-    event_.signal("scene_game");
+
+    holder_ += event_.connect("debug_audio_stats",
+                              [this](const Arguments&) {
+                                DOUT << "debug_audio_stats" << std::endl;
+
+                                if (audio_) audio_->reportStats();
+                              });
+
+    // PLY読み込みの計測
+    holder_ += event_.connect("debug_ply_benchmark",
+                              [this](const Arguments&) {
+                                DOUT << "debug_ply_benchmark" << std::endl;
+
+                                PLY::benchmark();
+                              });
+
+    // メッシュの変換
+    holder_ += event_.connect("debug_cook_meshes",
+                              [this](const Arguments&) {
+                                DOUT << "debug_cook_meshes" << std::endl;
+
+                                CookedMesh::cookAll();
+                              });
+
+    // テクスチャの変換
+    holder_ += event_.connect("debug_cook_textures",
+                              [this](const Arguments&) {
+                                DOUT << "debug_cook_textures" << std::endl;
+
+                                CookedTexture::cookAll(params_.json["cooked_texture"]);
+                              });
+
+    // アセットパックの作成
+    // TIPS:変換済みメッシュ・テクスチャも含めるので、先に変換しておく
+    holder_ += event_.connect("debug_build_asset_pack",
+                              [this](const Arguments&) {
+                                DOUT << "debug_build_asset_pack" << std::endl;
+
+                                CookedMesh::cookAll();
+                                CookedTexture::cookAll(params_.json["cooked_texture"]);
+
+                                auto directory = getAssetPath("params.json").parent_path();
+                                AssetPack::build(directory, directory / "assets.pack");
+                              });
+
+    // 計測した区間の内訳
+    holder_ += event_.connect("debug_timing",
+                              [this](const Arguments&) {
+                                DOUT << "debug_timing" << std::endl;
+
+                                getTiming().report();
+                                getTiming().write(getDocumentPath() / "timing.json");
+                              });
+
+#if defined (DEBUG)
+    // GPUを使わない処理の検証
+    RayTriangleTest::test(params_.json);
+    RenderQueueTest::test();
+#endif
+
+    // 最初のシーンは先読みが終わってから生成
+    setupPreloader();
   }
 
 
   void cleanup() {
-    game_->cleanup();
+    if (game_) game_->cleanup();
   }
 
   
@@ -136,16 +327,19 @@ public:
   // touching_numはタッチ操作中の数(新たに発生したのも含む)
   // touchesは新たに発生したタッチイベント内容
   void touchesBegan(const int touching_num, const std::vector<Touch>& touches) {
+    if (scene_stack_.empty()) return;
     scene_stack_.front()->touchesBegan(touching_num, touches);
   }
 
   // touching_numはタッチ操作中の数
   void touchesMoved(const int touching_num, const std::vector<Touch>& touches) {
+    if (scene_stack_.empty()) return;
     scene_stack_.front()->touchesMoved(touching_num, touches);
   }
 
   // touching_numは残りのタッチ操作中の数
   void touchesEnded(const int touching_num, const std::vector<Touch>& touches) {
+    if (scene_stack_.empty()) return;
     scene_stack_.front()->touchesEnded(touching_num, touches);
   }
   
@@ -153,6 +347,14 @@ public:
   void update() {
     timeline_->stepTo(ci::app::getElapsedSeconds());
 
+    if (preloader_) {
+      preloader_->update();
+      if (!preloader_->isDone()) return;
+
+      // TIPS:最初のフレームから景色を描画できるよう、同じフレームで画面を更新する
+      finishPreload();
+    }
+
     // 無効な画面を削除
     for (auto it = std::begin(scene_stack_); it != std::end(scene_stack_); ) {
       if (!(*it)->isActive()) {
@@ -168,14 +370,26 @@ public:
   }
 
   void draw() {
+    if (scene_stack_.empty()) {
+      if (!loading_frame_) {
+        getTiming().mark("first_loading_frame");
+        loading_frame_ = true;
+      }
+      if (preloader_) drawLoading();
+      return;
+    }
+
     // 最前列の画面だけ描画
     scene_stack_.front()->draw(false);
+
+    // TIPS:景色を描画した最初のフレームまでを計測する
+    if ((startup_timing_ >= 0) && game_->isReady()) finishStartup();
   }
 
 
   // デバッグ用途
   Event& getEvent() { return event_; }
-  const ci::JsonTree& getParams() const { return params_; }
+  const Params& getParams() const { return params_; }
 
 };
 
@@ -3,11 +3,15 @@
 //
 // シェーダー
 //   GLSL3.30と3.0ESの違いを吸収する
+//   共通部分は #include "name" で別ファイルから取り込む
 //
 
+#include <algorithm>
+#include <ctime>
 #include <fstream>
+#include <map>
+#include <set>
 #include <utility>
-#include <regex>
 #include "Path.hpp"
 
 
@@ -27,35 +31,145 @@ std::string readFile(const std::string& path) {
 }
 
 
-// 機種依存部分を置換
-std::string replaceText(std::string text) {
-  std::vector<std::pair<std::regex, std::string>> replace{
+// 機種依存部分
+//   シェーダー内の $name$ を置換する
+const std::map<std::string, std::string>& getShaderTokens() {
+  static const std::map<std::string, std::string> tokens = {
 #if defined (CINDER_COCOA_TOUCH)
-    { std::regex("\\$version\\$"), "#version 300 es" },
-    { std::regex("\\$precision\\$"), "precision mediump float;" },
+    { "version",   "#version 300 es" },
+    { "precision", "precision mediump float;" },
 #else
-    { std::regex("\\$version\\$"), "#version 330" },
-    { std::regex("\\$precision\\$"), "" },
+    { "version",   "#version 330" },
+    { "precision", "" },
 #endif
   };
 
-  for (const auto& t : replace) {
-    text = std::regex_replace(text, t.first, t.second);
+  return tokens;
+}
+
+
+// 前処理済みのシェーダー
+struct ShaderSource {
+  std::string text;
+  // 読み込んだファイルと更新日時(インクルードしたものも含む)
+  std::vector<std::pair<ci::fs::path, std::time_t>> files;
+};
+
+// 一行ずつ走査して、$name$ の置換と #include の展開を一度に行う
+//   TIPS:同じファイルは一度だけ展開する
+void preprocessShader(const ci::fs::path& path, ShaderSource& source, std::set<ci::fs::path>& included) {
+  if (!included.insert(path).second) return;
+
+  if (path.empty() || !ci::fs::exists(path)) {
+    DOUT << "shader not found: " << path << std::endl;
+    return;
+  }
+  source.files.push_back(std::make_pair(path, ci::fs::last_write_time(path)));
+
+  const auto text    = readFile(path.string());
+  const auto& tokens = getShaderTokens();
+
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t line_end = std::min(text.find('\n', pos), text.size());
+
+    // #include "name"
+    size_t head = text.find_first_not_of(" \t", pos);
+    if ((head < line_end) && (text.compare(head, 8, "#include") == 0)) {
+      size_t open  = text.find('"', head);
+      size_t close = (open < line_end) ? text.find('"', open + 1) : std::string::npos;
+      if (close < line_end) {
+        preprocessShader(getAssetPath(text.substr(open + 1, close - open - 1)), source, included);
+      }
+      else {
+        DOUT << "shader: invalid include " << text.substr(head, line_end - head) << std::endl;
+      }
+
+      pos = line_end + 1;
+      continue;
+    }
+
+    // $name$
+    size_t p = pos;
+    while (p < line_end) {
+      size_t first = text.find('$', p);
+      if (first >= line_end) {
+        source.text.append(text, p, line_end - p);
+        break;
+      }
+
+      size_t last = text.find('$', first + 1);
+      auto it = (last < line_end) ? tokens.find(text.substr(first + 1, last - first - 1)) : std::end(tokens);
+      if (it == std::end(tokens)) {
+        source.text.append(text, p, first + 1 - p);
+        p = first + 1;
+        continue;
+      }
+
+      source.text.append(text, p, first - p);
+      source.text += it->second;
+      p = last + 1;
+    }
+    source.text += '\n';
+
+    pos = line_end + 1;
+  }
+}
+
+// 前処理済みのシェーダーを読み込む
+//   インクルードしたものも含めて更新されていなければ、前回の結果を使う
+const std::string& loadShaderSource(const std::string& path) {
+  static std::map<std::string, ShaderSource> cache;
+
+  auto it = cache.find(path);
+  if (it != std::end(cache)) {
+    const auto& files = it->second.files;
+    bool fresh = std::all_of(std::begin(files), std::end(files),
+                             [](const std::pair<ci::fs::path, std::time_t>& file) {
+                               return ci::fs::exists(file.first)
+                                   && (ci::fs::last_write_time(file.first) == file.second);
+                             });
+    if (fresh) return it->second.text;
   }
 
-  return text;
+  ShaderSource source;
+  std::set<ci::fs::path> included;
+  preprocessShader(getAssetPath(path), source, included);
+
+  auto& entry = cache[path];
+  entry = std::move(source);
+  return entry.text;
+}
+
+
+// マクロ定義を#versionの直後に挿入
+std::string insertDefines(const std::string& text, const std::vector<std::string>& defines) {
+  if (defines.empty()) return text;
+
+  std::string lines;
+  for (const auto& define : defines) {
+    lines += "#define " + define + "\n";
+  }
+
+  // TIPS:#versionより前には何も書けない
+  auto pos = text.find("#version");
+  if (pos == std::string::npos) return lines + text;
+
+  auto end = text.find('\n', pos);
+  if (end == std::string::npos) return text + "\n" + lines;
+
+  return text.substr(0, end + 1) + lines + text.substr(end + 1);
 }
 
 
 // シェーダーを読み込む
 //   パスに拡張子は要らない
+//   definesは両方のシェーダーに定義される
 Shader readShader(const std::string& vertex_path,
-                  const std::string& fragment_path) {
-  auto vertex_shader   = readFile(getAssetPath(vertex_path + ".vsh").string());
-  vertex_shader = replaceText(vertex_shader);
-  
-  auto fragment_shader = readFile(getAssetPath(fragment_path + ".fsh").string());
-  fragment_shader = replaceText(fragment_shader);
+                  const std::string& fragment_path,
+                  const std::vector<std::string>& defines = {}) {
+  auto vertex_shader   = insertDefines(loadShaderSource(vertex_path + ".vsh"), defines);
+  auto fragment_shader = insertDefines(loadShaderSource(fragment_path + ".fsh"), defines);
 
   return std::make_pair(vertex_shader, fragment_shader);
 }